@@ -0,0 +1,71 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/if_addr.h>
+
+#include "en.h"
+
+static void addr_modify(ArgParser *ap, int cmd, int flags)
+{
+	struct {
+		struct nlmsghdr  nh;
+		struct ifaddrmsg ifa;
+		char             attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+		.nh.nlmsg_type  = cmd,
+		.nh.nlmsg_flags = flags,
+	};
+	int i, alen, argc = ap_len_args(ap);
+	struct prefix pfx;
+
+	if (argc < 1)
+		en_errx(1, "missing address");
+	en_parse_prefix(ap_get_arg(ap, 0), &pfx);
+	if (!strcmp(ap_get_arg(ap, 0), "default"))
+		en_errx(1, "invalid address 'default'");
+
+	for (i = 1; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+
+		if (++i >= argc)
+			en_errx(1, "missing argument to '%s'", arg);
+
+		if (!strcmp(arg, "dev"))
+			req.ifa.ifa_index = en_ifindex(ap_get_arg(ap, i));
+		else
+			en_errx(1, "unknown argument '%s'", arg);
+	}
+	if (!req.ifa.ifa_index)
+		en_errx(1, "missing 'dev IFNAME'");
+
+	alen = pfx.family == AF_INET6 ? 16 : 4;
+	req.ifa.ifa_family = pfx.family;
+	req.ifa.ifa_prefixlen = pfx.len;
+	nl_attr_put(&req.nh, sizeof(req), IFA_LOCAL, pfx.addr, alen);
+	nl_attr_put(&req.nh, sizeof(req), IFA_ADDRESS, pfx.addr, alen);
+
+	en_tx(&req.nh);
+}
+
+static void addr_add(ArgParser *ap)
+{
+	addr_modify(ap, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL);
+}
+
+static void addr_del(ArgParser *ap)
+{
+	addr_modify(ap, RTM_DELADDR, 0);
+}
+
+static void addr_cmds(ArgParser *addr)
+{
+	ap_add_cmd(addr, "add", "Add address: ADDR/LEN dev IFNAME", addr_add);
+	ap_add_cmd(addr, "del delete", "Delete address: ADDR/LEN dev IFNAME", addr_del);
+}
+
+int addr_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "addr address", "Interface address management", addr_cmds, NULL);
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "en.h"
+
+static bool active;
+
+bool batch_active(void)
+{
+	return active;
+}
+
+/* Does the line end in a backslash-newline, with the backslash not escaped? */
+static bool continued(const char *line)
+{
+	size_t len = strlen(line), n = 0;
+
+	if (!len || line[len - 1] != '\n')
+		return false;
+	for (len--; len > 0 && line[len - 1] == '\\'; len--)
+		n++;
+
+	return n % 2;
+}
+
+/*
+ * Run one command per line from @file, or stdin if "-", through the same
+ * parser tree and netlink socket.  Failing lines are reported and then
+ * skipped, the return value is non-zero if any line failed.  Batches do
+ * not nest, a file could include itself.
+ */
+int batch(ArgParser *ap, const char *name)
+{
+	int argc, max = 0, lineno = 0, start, failed = 0;
+	char **argv = NULL, *line = NULL, *more = NULL, tag[NL_TAGSZ];
+	size_t len = 0, mlen = 0;
+	char *file;
+	FILE *fp;
+
+	if (active)
+		en_errx(1, "already in batch mode");
+
+	if (!strcmp(name, "-"))
+		fp = stdin;
+	else {
+		fp = fopen(name, "r");
+		if (!fp)
+			en_err(1, "%s", name);
+	}
+
+	/* @name may point into an argument file the next line replaces */
+	file = strdup(name);
+	if (!file)
+		err(1, "Failed allocating file name");
+	active = true;
+
+	while (getline(&line, &len, fp) != -1) {
+		lineno++;
+		start = lineno;
+
+		/* A line ending in an unescaped backslash continues on the next */
+		while (continued(line)) {
+			ssize_t n = getline(&more, &mlen, fp);
+			char *joined;
+
+			if (n == -1)
+				break;
+			lineno++;
+			joined = realloc(line, strlen(line) + n + 1);
+			if (!joined)
+				err(1, "Failed allocating line");
+			line = joined;
+			len = strlen(line) + n + 1;
+			strcat(line, more);
+		}
+
+		argc = ap_tokenize(line, &argv, &max);
+		if (argc < 0) {
+			warnx("%s:%d: unterminated quote", file, start);
+			failed++;
+			continue;
+		}
+		if (argc < 2)
+			continue;
+		argv[0] = "en";
+
+		/* Changes may fail later, when their ACK comes back */
+		snprintf(tag, sizeof(tag), "%s:%d", file, start);
+		en_set_tag(tag);
+
+		if (en_run(ap, argc, argv)) {
+			warnx("%s: command failed", tag);
+			failed++;
+		}
+	}
+	en_set_tag(NULL);
+	failed += en_tx_flush();
+	active = false;
+
+	free(argv);
+	free(line);
+	free(more);
+	free(file);
+	if (fp != stdin)
+		fclose(fp);
+
+	return failed ? 1 : 0;
+}
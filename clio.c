@@ -14,6 +14,18 @@
 #include <errno.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 // -------------------------------------------------------------------------
@@ -22,7 +34,19 @@
 
 
 typedef struct ArgParser ArgParser;
+typedef struct Option ApOpt;
+typedef enum ApFormat { AP_TEXT, AP_JSON } ApFormat;
 typedef void (*CmdCB)(ArgParser *parser);
+typedef void (*CmdInitCB)(ArgParser *parser);
+typedef void (*ExitCB)(int status);
+typedef void (*CmdHook)(ArgParser *parser, CmdCB cb);
+
+
+// Optional callback invoked in place of exit().
+static ExitCB exit_cb = NULL;
+
+// Optional hook invoked in place of command callbacks.
+static CmdHook cmd_hook = NULL;
 
 
 // -------------------------------------------------------------------------
@@ -30,10 +54,22 @@ typedef void (*CmdCB)(ArgParser *parser);
 // -------------------------------------------------------------------------
 
 
+// Exit with the specified status code. If the user has registered an exit
+// callback it gets the chance to take over first, e.g. to continue with the
+// next of several parses.
+static void argparser_exit(int status) {
+    if (exit_cb != NULL) {
+        exit_cb(status);
+    }
+    exit(status);
+}
+
+
 // Print a message to stderr and exit with a non-zero error code.
 static void err(char *msg) {
     fprintf(stderr, "Error: %s.\n", msg);
-    exit(1);
+    free(msg);
+    argparser_exit(1);
 }
 
 
@@ -106,6 +142,97 @@ static double try_str_to_double(char *arg) {
 }
 
 
+// -------------------------------------------------------------------------
+// StrBuf
+// -------------------------------------------------------------------------
+
+
+// A growable output buffer. Text is only ever appended, so rendering into a
+// StrBuf takes time linear in the length of the output.
+typedef struct StrBuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+
+// Make room for another len bytes plus the terminating null.
+static void strbuf_reserve(StrBuf *buf, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 256;
+        while (buf->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        buf->data = realloc(buf->data, cap);
+        buf->cap = cap;
+    }
+}
+
+
+// Append len bytes to the buffer.
+static void strbuf_add(StrBuf *buf, const char *data, size_t len) {
+    strbuf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+
+// Append a string to the buffer.
+static void strbuf_puts(StrBuf *buf, const char *string) {
+    strbuf_add(buf, string, strlen(string));
+}
+
+
+// Append formatted output to the buffer.
+static void strbuf_printf(StrBuf *buf, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 1) {
+        return;
+    }
+
+    strbuf_reserve(buf, len);
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, len + 1, fmt, args);
+    va_end(args);
+    buf->len += len;
+}
+
+
+// Append a string as a quoted JSON string, or null.
+static void strbuf_json_str(StrBuf *buf, const char *string) {
+    if (string == NULL) {
+        strbuf_puts(buf, "null");
+        return;
+    }
+
+    strbuf_add(buf, "\"", 1);
+    for (const char *c = string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            strbuf_add(buf, "\\", 1);
+            strbuf_add(buf, c, 1);
+        } else if ((unsigned char)*c < 0x20) {
+            strbuf_printf(buf, "\\u%04x", (unsigned char)*c);
+        } else {
+            strbuf_add(buf, c, 1);
+        }
+    }
+    strbuf_add(buf, "\"", 1);
+}
+
+
+// Append the spaces for an indentation level.
+static void strbuf_indent(StrBuf *buf, int indent) {
+    for (int i = 0; i < indent; i++) {
+        strbuf_add(buf, " ", 1);
+    }
+}
+
+
 // -------------------------------------------------------------------------
 // Map
 // -------------------------------------------------------------------------
@@ -238,6 +365,19 @@ static void* map_get(Map *map, char *key) {
 }
 
 
+// Retrieve a value by a key that is the first len bytes of a string, which
+// need not be NUL-terminated there. Returns NULL if the key is not found.
+static void* map_get_len(Map *map, const char *key, size_t len) {
+    for (int i = 0; i < map->len; i++) {
+        if (strncmp(key, map->entries[i].key, len) == 0 &&
+            map->entries[i].key[len] == '\0') {
+            return map->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+
 // Returns the key at the specified index.
 static char* map_key_at_index(Map *map, int i) {
     return map->entries[i].key;
@@ -257,36 +397,179 @@ static void* map_value_at_index(Map *map, int i) {
 
 // We use 'flag' as a synonym for boolean options, i.e. options that are either
 // present (true) or absent (false). All other option types require an argument.
+// A choice option takes one of a fixed set of strings and stores its index.
 typedef enum OptionType {
     FLAG,
     STRING,
     INTEGER,
     FLOAT,
+    CHOICE,
 } OptionType;
 
 
-// Union combining all four valid types of option value.
-typedef union OptionValue {
-    bool bool_val;
-    char *str_val;
-    int int_val;
-    double float_val;
-} OptionValue;
+// Size of a single value of each option type.
+static const size_t option_sizes[] = {
+    [FLAG] = sizeof(bool),
+    [STRING] = sizeof(char*),
+    [INTEGER] = sizeof(int),
+    [FLOAT] = sizeof(double),
+    [CHOICE] = sizeof(int),
+};
+
+
+// The set of strings a choice option accepts, with a perfect hash built when
+// the option is registered: every choice has a slot of its own, so a lookup
+// is one hash and at most one strcmp(), however many choices there are.
+// Should no table up to CHOICES_MAX_SLOTS work, slots is NULL and lookups
+// fall back to comparing against every choice in turn.
+typedef struct Choices {
+    const char *const *names;
+    int len;
+    uint32_t seed;
+    uint32_t mask;
+    int *slots;     // Index into names, or -1 for an empty slot.
+} Choices;
+
+
+#define CHOICES_MAX_SLOTS 4096
 
 
-// An Option instance represents an option registered on a parser.
+// FNV-1a, with the seed mixed into the offset basis.
+static uint32_t choices_hash(uint32_t seed, const char *string) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (const char *c = string; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+// Free the memory occupied by a Choices instance.
+static void choices_free(Choices *choices) {
+    if (choices != NULL) {
+        free(choices->slots);
+        free(choices);
+    }
+}
+
+
+// Build the perfect hash for a NULL-terminated array of choices. Starting
+// with the smallest power-of-two table that fits, try a number of seeds for
+// one that puts every choice in a different slot, then double the table, up
+// to CHOICES_MAX_SLOTS.
+static Choices* choices_new(const char *const names[]) {
+    Choices *choices = malloc(sizeof(Choices));
+    choices->names = names;
+    choices->len = 0;
+    while (names[choices->len] != NULL) {
+        choices->len++;
+    }
+
+    for (int i = 0; i < choices->len; i++) {
+        for (int j = 0; j < i; j++) {
+            if (strcmp(names[i], names[j]) == 0) {
+                err(str("duplicate choice '%s'", names[i]));
+            }
+        }
+    }
+
+    uint32_t size = 1;
+    while (size < (uint32_t)choices->len && size < CHOICES_MAX_SLOTS) {
+        size *= 2;
+    }
+    choices->slots = NULL;
+
+    for (; size <= CHOICES_MAX_SLOTS && size >= (uint32_t)choices->len; size *= 2) {
+        choices->slots = realloc(choices->slots, size * sizeof(int));
+        choices->mask = size - 1;
+
+        for (choices->seed = 0; choices->seed < 64; choices->seed++) {
+            bool collision = false;
+            for (uint32_t i = 0; i < size; i++) {
+                choices->slots[i] = -1;
+            }
+            for (int i = 0; i < choices->len && !collision; i++) {
+                uint32_t slot = choices_hash(choices->seed, names[i]) & choices->mask;
+                if (choices->slots[slot] != -1) {
+                    collision = true;
+                }
+                choices->slots[slot] = i;
+            }
+            if (!collision) {
+                return choices;
+            }
+        }
+    }
+
+    free(choices->slots);
+    choices->slots = NULL;
+    choices->seed = 0;
+    choices->mask = 0;
+    return choices;
+}
+
+
+// Returns the index of a string in the set of choices, or -1.
+static int choices_find(Choices *choices, const char *string) {
+    if (choices->len == 0) {
+        return -1;
+    }
+    if (choices->slots == NULL) {
+        for (int i = 0; i < choices->len; i++) {
+            if (strcmp(choices->names[i], string) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    uint32_t slot = choices_hash(choices->seed, string) & choices->mask;
+    int index = choices->slots[slot];
+    if (index != -1 && strcmp(choices->names[index], string) == 0) {
+        return index;
+    }
+    return -1;
+}
+
+
+// Returns the name of a choice, or NULL for an index out of range, e.g. a
+// default of -1.
+static const char* choices_name(Choices *choices, int index) {
+    if (index < 0 || index >= choices->len) {
+        return NULL;
+    }
+    return choices->names[index];
+}
+
+
+// An Option instance represents an option registered on a parser. Its values
+// are stored in an array of the option's own type, i.e. a bool[], char*[],
+// int[] or double[], so a list can be handed out with a single memcpy().
+// Choice options store the index of the choice in an int[].
 typedef struct Option {
     OptionType type;
     bool found;
     bool greedy;
+    int base;
     int len;
     int cap;
-    OptionValue *values;
+    size_t size;
+    void *values;
+    void *bind;
+    Choices *choices;
 } Option;
 
 
+// Typed access to an Option instance's array of values.
+#define FLAG_VALUES(opt) ((bool*)(opt)->values)
+#define STR_VALUES(opt) ((char**)(opt)->values)
+#define INT_VALUES(opt) ((int*)(opt)->values)
+#define FLOAT_VALUES(opt) ((double*)(opt)->values)
+
+
 // Free the memory occupied by an Option instance.
 static void option_free(Option *opt) {
+    choices_free(opt->choices);
     free(opt->values);
     free(opt);
 }
@@ -304,37 +587,56 @@ static void option_clear(Option *opt) {
 }
 
 
+// Write an Option instance's current value to the caller's variable, if
+// the option is bound to one.
+static void option_store(Option *opt) {
+    if (opt->bind != NULL && opt->len > 0) {
+        memcpy(opt->bind, (char*)opt->values + (opt->len - 1) * opt->size, opt->size);
+    }
+}
+
+
+// Reset an Option instance to its registered state, keeping its default
+// value if it has one.
+static void option_reset(Option *opt) {
+    opt->found = false;
+    opt->len = opt->base;
+    option_store(opt);
+}
+
+
 // Append a value to an Option instance's internal list of values.
-static void option_append(Option *opt, OptionValue value) {
+static void option_append(Option *opt, const void *value) {
     if (opt->len == opt->cap) {
         opt->cap *= 2;
-        opt->values = realloc(opt->values, sizeof(OptionValue) * opt->cap);
+        opt->values = realloc(opt->values, opt->size * opt->cap);
     }
-    opt->values[opt->len++] = value;
+    memcpy((char*)opt->values + opt->len++ * opt->size, value, opt->size);
+    option_store(opt);
 }
 
 
 // Append a value to a boolean option's internal list.
 static void option_set_flag(Option *opt, bool value) {
-    option_append(opt, (OptionValue){.bool_val = value});
+    option_append(opt, &value);
 }
 
 
 // Append a value to a string option's internal list.
 static void option_set_str(Option *opt, char *value) {
-    option_append(opt, (OptionValue){.str_val = value});
+    option_append(opt, &value);
 }
 
 
 // Append a value to an integer option's internal list.
 static void option_set_int(Option *opt, int value) {
-    option_append(opt, (OptionValue){.int_val = value});
+    option_append(opt, &value);
 }
 
 
 // Append a value to a floating-point option's internal list.
 static void option_set_float(Option *opt, double value) {
-    option_append(opt, (OptionValue){.float_val = value});
+    option_append(opt, &value);
 }
 
 
@@ -350,69 +652,97 @@ static void option_try_set(Option *opt, char *arg) {
     else if (opt->type == FLOAT) {
         option_set_float(opt, try_str_to_double(arg));
     }
+    else if (opt->type == CHOICE) {
+        int index = choices_find(opt->choices, arg);
+        if (index == -1) {
+            StrBuf buf = {NULL, 0, 0};
+            for (int i = 0; i < opt->choices->len; i++) {
+                strbuf_puts(&buf, i > 0 ? ", " : "");
+                strbuf_puts(&buf, opt->choices->names[i]);
+            }
+            char *msg = str("invalid choice '%s', expected one of: %s", arg,
+                buf.data ? buf.data : "");
+            free(buf.data);
+            err(msg);
+        }
+        option_set_int(opt, index);
+    }
 }
 
 
 // Initialize a new Option instance.
-static Option* option_new() {
+static Option* option_new(OptionType type) {
     Option *option = malloc(sizeof(Option));
+    option->type = type;
+    option->size = option_sizes[type];
     option->found = false;
     option->greedy = false;
+    option->base = 0;
     option->len = 0;
     option->cap = 1;
-    option->values = malloc(sizeof(OptionValue) * option->cap);
+    option->values = malloc(option->size * option->cap);
+    option->bind = NULL;
+    option->choices = NULL;
     return option;
 }
 
 
 // Initialize a boolean option.
 static Option* option_new_flag() {
-    Option *opt = option_new();
-    opt->type = FLAG;
+    Option *opt = option_new(FLAG);
     option_set_flag(opt, false);
+    opt->base = 1;
     return opt;
 }
 
 
 // Initialize a string option with a default value.
 static Option* option_new_str(char *value) {
-    Option *opt = option_new();
-    opt->type = STRING;
+    Option *opt = option_new(STRING);
     option_set_str(opt, value);
+    opt->base = 1;
     return opt;
 }
 
 
 // Initialize an integer option with a default value.
 static Option* option_new_int(int value) {
-    Option *opt = option_new();
-    opt->type = INTEGER;
+    Option *opt = option_new(INTEGER);
     option_set_int(opt, value);
+    opt->base = 1;
     return opt;
 }
 
 
 // Initialize a floating-point option with a default value.
 static Option* option_new_float(double value) {
-    Option *opt = option_new();
-    opt->type = FLOAT;
+    Option *opt = option_new(FLOAT);
     option_set_float(opt, value);
+    opt->base = 1;
+    return opt;
+}
+
+
+// Initialize a choice option with the index of its default choice.
+static Option* option_new_choice(const char *const choices[], int value) {
+    Option *opt = option_new(CHOICE);
+    opt->choices = choices_new(choices);
+    option_set_int(opt, value);
+    opt->base = 1;
     return opt;
 }
 
 
 // Initialize a boolean list option.
 static Option* option_new_flag_list() {
-    Option *opt = option_new();
-    opt->type = FLAG;
+    Option *opt = option_new(FLAG);
     return opt;
 }
 
 
 // Initialize a string list option.
 static Option* option_new_str_list(bool greedy) {
-    Option *opt = option_new();
-    opt->type = STRING;
+    Option *opt = option_new(STRING);
     opt->greedy = greedy;
     return opt;
 }
@@ -420,8 +750,7 @@ static Option* option_new_str_list(bool greedy) {
 
 // Initialize an integer list option.
 static Option* option_new_int_list(bool greedy) {
-    Option *opt = option_new();
-    opt->type = INTEGER;
+    Option *opt = option_new(INTEGER);
     opt->greedy = greedy;
     return opt;
 }
@@ -429,8 +758,7 @@ static Option* option_new_int_list(bool greedy) {
 
 // Initialize a floating-point list option.
 static Option* option_new_float_list(bool greedy) {
-    Option *opt = option_new();
-    opt->type = FLOAT;
+    Option *opt = option_new(FLOAT);
     opt->greedy = greedy;
     return opt;
 }
@@ -438,109 +766,95 @@ static Option* option_new_float_list(bool greedy) {
 
 // Returns the value of a boolean option.
 static bool option_get_flag(Option *opt) {
-    return opt->values[opt->len - 1].bool_val;
+    return FLAG_VALUES(opt)[opt->len - 1];
 }
 
 
 // Returns the value of a string option.
 static char* option_get_str(Option *opt) {
-    return opt->values[opt->len - 1].str_val;
+    return STR_VALUES(opt)[opt->len - 1];
 }
 
 
 // Returns the value of an integer option.
 static int option_get_int(Option *opt) {
-    return opt->values[opt->len - 1].int_val;
+    return INT_VALUES(opt)[opt->len - 1];
 }
 
 
 // Returns the value of a floating-point option.
 static double option_get_float(Option *opt) {
-    return opt->values[opt->len - 1].float_val;
+    return FLOAT_VALUES(opt)[opt->len - 1];
 }
 
 
-// Returns a list-option's values as a freshly-allocated array of bools.
-static bool* option_get_flag_list(Option *opt) {
+// Returns a freshly-allocated copy of an Option instance's array of values.
+static void* option_copy_values(Option *opt) {
     if (opt->len == 0) {
         return NULL;
     }
-    bool *list = malloc(sizeof(bool) * opt->len);
-    for (int i = 0; i < opt->len; i++) {
-        list[i] = opt->values[i].bool_val;
-    }
-    return list;
+    void *list = malloc(opt->size * opt->len);
+    return list ? memcpy(list, opt->values, opt->size * opt->len) : NULL;
+}
+
+
+// Returns a list-option's values as a freshly-allocated array of bools.
+static bool* option_get_flag_list(Option *opt) {
+    return option_copy_values(opt);
 }
 
 
 // Returns a list-option's values as a freshly-allocated array of strings.
 static char** option_get_str_list(Option *opt) {
-    if (opt->len == 0) {
-        return NULL;
-    }
-    char **list = malloc(sizeof(char*) * opt->len);
-    for (int i = 0; i < opt->len; i++) {
-        list[i] = opt->values[i].str_val;
-    }
-    return list;
+    return option_copy_values(opt);
 }
 
 
 // Returns a list-option's values as a freshly-allocated array of integers.
 static int* option_get_int_list(Option *opt) {
-    if (opt->len == 0) {
-        return NULL;
-    }
-    int *list = malloc(sizeof(int) * opt->len);
-    for (int i = 0; i < opt->len; i++) {
-        list[i] = opt->values[i].int_val;
-    }
-    return list;
+    return option_copy_values(opt);
 }
 
 
 // Returns a list-option's values as a freshly-allocated array of doubles.
 static double* option_get_float_list(Option *opt) {
-    if (opt->len == 0) {
-        return NULL;
-    }
-    double *list = malloc(sizeof(double) * opt->len);
-    for (int i = 0; i < opt->len; i++) {
-        list[i] = opt->values[i].float_val;
-    }
-    return list;
+    return option_copy_values(opt);
 }
 
 
-// Returns a freshly-allocated string representing an Option instance.
-static char* option_str(Option *opt) {
-    char *tmpstr = str_dup("[");
+// Append an Option instance's list of values to the buffer, as text or as a
+// JSON array.
+static void option_render(Option *opt, StrBuf *buf, ApFormat format) {
+    bool json = format == AP_JSON;
 
+    strbuf_add(buf, "[", 1);
     for (int i = 0; i < opt->len; i++) {
-        char *valstr = NULL;
+        if (i > 0) {
+            strbuf_puts(buf, json ? "," : ", ");
+        }
 
         if (opt->type == FLAG) {
-            valstr = str_dup(opt->values[i].bool_val ? "true" : "false");
+            strbuf_puts(buf, FLAG_VALUES(opt)[i] ? "true" : "false");
+        } else if (opt->type == STRING && json) {
+            strbuf_json_str(buf, STR_VALUES(opt)[i]);
         } else if (opt->type == STRING) {
-            valstr = str_dup(opt->values[i].str_val);
+            strbuf_puts(buf, STR_VALUES(opt)[i] ? STR_VALUES(opt)[i] : "null");
         } else if (opt->type == INTEGER) {
-            valstr = str("%i", opt->values[i].int_val);
+            strbuf_printf(buf, "%i", INT_VALUES(opt)[i]);
+        } else if (opt->type == FLOAT && json && !isfinite(FLOAT_VALUES(opt)[i])) {
+            strbuf_puts(buf, "null");
         } else if (opt->type == FLOAT) {
-            valstr = str("%f", opt->values[i].float_val);
+            strbuf_printf(buf, json ? "%.17g" : "%f", FLOAT_VALUES(opt)[i]);
+        } else if (opt->type == CHOICE) {
+            const char *name = choices_name(opt->choices, INT_VALUES(opt)[i]);
+            if (json) {
+                strbuf_json_str(buf, name);
+            } else {
+                strbuf_puts(buf, name ? name : "null");
+            }
         }
-
-        char *tmpstr_old = tmpstr;
-        char *format = (i == 0) ? "%s%s" : "%s, %s";
-        tmpstr = str(format, tmpstr_old, valstr);
-
-        free(tmpstr_old);
-        free(valstr);
     }
-
-    char *outstr = str("%s%s", tmpstr, "]");
-    free(tmpstr);
-
-    return outstr;
+    strbuf_add(buf, "]", 1);
 }
 
 
@@ -549,15 +863,71 @@ static char* option_str(Option *opt) {
 // -------------------------------------------------------------------------
 
 
+// The kinds of argument told apart by the parser.
+typedef enum ArgKind {
+    ARG_POSITIONAL,     // Anything else, including a single dash.
+    ARG_NUMBER,         // A dash followed by a digit, e.g. -1 or -0.5.
+    ARG_DASHDASH,       // Exactly '--', turns off option parsing.
+    ARG_LONG,           // --name or --name=value.
+    ARG_SHORT,          // -abc or -n=value.
+} ArgKind;
+
+
+// What the parser needs to know about an argument, worked out once for each
+// argument when the stream is created instead of on every look at it.
+typedef struct ArgInfo {
+    unsigned int len;
+    unsigned int eq : 29;   // Offset of the first '=' in an option, or 0.
+    unsigned int kind : 3;
+} ArgInfo;
+
+
 // An ArgStream instance is a wrapper for an array of string pointers,
-// allowing it to be accessed as a stream.
+// allowing it to be accessed as a stream. Each argument's ArgInfo is kept
+// in a side array allocated along with the stream. A command callback may
+// parse again with the same parser, the streams in progress form a stack.
 typedef struct ArgStream {
     int len;
     int index;
     char **args;
+    struct ArgStream *prev;
+    ArgInfo info[];
 } ArgStream;
 
 
+// Classify an argument in a single pass over its bytes.
+static ArgInfo arg_classify(const char *arg) {
+    ArgInfo info = {.len = 0, .eq = 0, .kind = ARG_POSITIONAL};
+
+    if (arg[0] != '-' || arg[1] == '\0') {
+        info.len = strlen(arg);
+        return info;
+    }
+    if (isdigit((unsigned char)arg[1])) {
+        info.len = strlen(arg);
+        info.kind = ARG_NUMBER;
+        return info;
+    }
+
+    const char *c = arg + 1;
+    for (; *c != '\0'; c++) {
+        if (*c == '=' && info.eq == 0) {
+            info.eq = c - arg;
+        }
+    }
+    info.len = c - arg;
+
+    if (arg[1] != '-') {
+        info.kind = ARG_SHORT;
+    } else if (arg[2] == '\0') {
+        info.kind = ARG_DASHDASH;
+    } else {
+        info.kind = ARG_LONG;
+    }
+    return info;
+}
+
+
 // Free the memory associated with an ArgStream instance.
 static void argstream_free(ArgStream *stream) {
     free(stream);
@@ -566,10 +936,14 @@ static void argstream_free(ArgStream *stream) {
 
 // Initialize a new ArgStream instance.
 static ArgStream* argstream_new(int len, char **args) {
-    ArgStream *stream = malloc(sizeof(ArgStream));
+    ArgStream *stream = malloc(sizeof(ArgStream) + len * sizeof(ArgInfo));
     stream->len = len;
     stream->index = 0;
     stream->args = args;
+    stream->prev = NULL;
+    for (int i = 0; i < len; i++) {
+        stream->info[i] = arg_classify(args[i]);
+    }
     return stream;
 }
 
@@ -580,9 +954,9 @@ static char* argstream_next(ArgStream *stream) {
 }
 
 
-// Returns the next argument from the stream without consuming it.
-static char* argstream_peek(ArgStream *stream) {
-    return stream->args[stream->index];
+// Returns the ArgInfo of the argument last returned by argstream_next().
+static ArgInfo argstream_info(ArgStream *stream) {
+    return stream->info[stream->index - 1];
 }
 
 
@@ -596,18 +970,290 @@ static bool argstream_has_next(ArgStream *stream) {
 // element has the form of an option value.
 static bool argstream_has_next_value(ArgStream *stream) {
     if (argstream_has_next(stream)) {
-        char *next = argstream_peek(stream);
-        if (next[0] == '-') {
-            if (strlen(next) == 1 || isdigit(next[1])) {
-                return true;
-            } else {
-                return false;
+        ArgKind kind = stream->info[stream->index].kind;
+        return kind == ARG_POSITIONAL || kind == ARG_NUMBER;
+    }
+    return false;
+}
+
+
+// -------------------------------------------------------------------------
+// Tokenizer
+// -------------------------------------------------------------------------
+
+
+// Returns true for the bytes that end a run of plain characters inside an
+// argument: whitespace, quotes, backslash and the terminating NUL.
+static bool tok_special(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+        c == '\'' || c == '"' || c == '\\' || c == '\0';
+}
+
+
+// Returns the length of the run of plain characters at the start of a
+// string. The vector versions step to an aligned address first, as an
+// aligned load never crosses into the next page it is safe to read past
+// the terminating NUL.
+#if defined(__AVX2__)
+static size_t tok_plain_len(const char *str) {
+    const char *p = str;
+
+    for (; (uintptr_t)p & 31; p++) {
+        if (tok_special(*p)) {
+            return p - str;
+        }
+    }
+
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i ht = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i sq = _mm256_set1_epi8('\'');
+    const __m256i dq = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i nul = _mm256_setzero_si256();
+
+    for (;; p += 32) {
+        __m256i v = _mm256_load_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, ht)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, sq), _mm256_cmpeq_epi8(v, dq)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, bs), _mm256_cmpeq_epi8(v, nul))));
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return p - str + __builtin_ctz(mask);
+        }
+    }
+}
+#elif defined(__SSE2__)
+static size_t tok_plain_len(const char *str) {
+    const char *p = str;
+
+    for (; (uintptr_t)p & 15; p++) {
+        if (tok_special(*p)) {
+            return p - str;
+        }
+    }
+
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i ht = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i sq = _mm_set1_epi8('\'');
+    const __m128i dq = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i nul = _mm_setzero_si128();
+
+    for (;; p += 16) {
+        __m128i v = _mm_load_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, ht)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, dq)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_cmpeq_epi8(v, nul))));
+        unsigned int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return p - str + __builtin_ctz(mask);
+        }
+    }
+}
+#else
+static size_t tok_plain_len(const char *str) {
+    const char *p = str;
+    while (!tok_special(*p)) {
+        p++;
+    }
+    return p - str;
+}
+#endif
+
+
+// Returns true for the bytes that separate arguments.
+static bool tok_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+// Split a string into arguments in place, see ap_tokenize(). Runs of plain
+// characters are found a vector at a time and only moved when an earlier
+// quote or escape has left a gap; unescaping only ever shortens an
+// argument, so it is rewritten where it starts and terminated by
+// overwriting the byte after it.
+static int tokenize(char *str, char ***args, int *max) {
+    char *rd = str;
+    int len = 1;
+
+    if (*max < 2) {
+        *max = 16;
+        *args = realloc(*args, *max * sizeof(char*));
+    }
+
+    while (true) {
+        // A backslash-newline between arguments joins lines as well.
+        while (tok_space(*rd) || (rd[0] == '\\' && rd[1] == '\n')) {
+            rd += *rd == '\\' ? 2 : 1;
+        }
+        if (*rd == '#') {
+            rd = strchr(rd, '\n');
+            if (rd == NULL) {
+                break;
             }
-        } else {
-            return true;
+            continue;
+        }
+        if (*rd == '\0') {
+            break;
         }
+
+        if (len + 1 >= *max) {
+            *max *= 2;
+            *args = realloc(*args, *max * sizeof(char*));
+        }
+        char *wr = rd;
+        (*args)[len++] = wr;
+
+        while (true) {
+            size_t n = tok_plain_len(rd);
+            if (wr != rd) {
+                memmove(wr, rd, n);
+            }
+            wr += n;
+            rd += n;
+
+            // Single quotes preserve everything up to the closing quote.
+            if (*rd == '\'') {
+                char *end = strchr(rd + 1, '\'');
+                if (end == NULL) {
+                    return -1;
+                }
+                memmove(wr, rd + 1, end - rd - 1);
+                wr += end - rd - 1;
+                rd = end + 1;
+            }
+
+            // Within double quotes a backslash only escapes '"' and itself.
+            else if (*rd == '"') {
+                for (rd++; *rd != '"'; rd++) {
+                    if (*rd == '\0') {
+                        return -1;
+                    }
+                    if (*rd == '\\' && (rd[1] == '"' || rd[1] == '\\')) {
+                        rd++;
+                    }
+                    *wr++ = *rd;
+                }
+                rd++;
+            }
+
+            // Elsewhere a backslash escapes any character, a backslash at
+            // the end of a line joins it with the next.
+            else if (*rd == '\\') {
+                if (rd[1] == '\n') {
+                    rd += 2;
+                } else if (rd[1] != '\0') {
+                    *wr++ = rd[1];
+                    rd += 2;
+                } else {
+                    *wr++ = *rd++;
+                }
+            }
+
+            else {
+                break;
+            }
+        }
+
+        if (*rd != '\0') {
+            rd++;
+        }
+        *wr = '\0';
+    }
+
+    (*args)[len] = NULL;
+    return len;
+}
+
+
+// -------------------------------------------------------------------------
+// ArgFile
+// -------------------------------------------------------------------------
+
+
+// An ArgFile instance holds the arguments read from a file. The file is
+// mapped copy-on-write and tokenized in place, each argument is a pointer
+// into the mapping, so reading a file costs no allocation per argument.
+// As with ap_tokenize(), the first slot of the array is left unused. An
+// instance without a mapping holds an argument array with files expanded.
+// A parser keeps them in a stack, tagged with the parse depth they are
+// used at, as string values point into them.
+typedef struct ArgFile {
+    char *map;
+    size_t size;
+    int len;
+    int max;
+    char **args;
+    int depth;
+    struct ArgFile *prev;
+} ArgFile;
+
+
+// Free the memory associated with an ArgFile instance.
+static void argfile_free(ArgFile *file) {
+    if (file != NULL) {
+        if (file->map != NULL) {
+            munmap(file->map, file->size);
+        }
+        free(file->args);
+        free(file);
+    }
+}
+
+
+// Load and split a file of arguments. A file whose size is a multiple of
+// the page size has no room for a terminating NUL, so the file is mapped
+// over an anonymous region one byte larger, which reads as zeros.
+static ArgFile* argfile_load(char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        err(str("cannot open '%s': %s", path, strerror(errno)));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        err(str("cannot read '%s': %s", path, strerror(errno)));
+    }
+
+    ArgFile *file = calloc(1, sizeof(ArgFile));
+    file->size = st.st_size + 1;
+    file->map = mmap(NULL, file->size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (file->map == MAP_FAILED) {
+        file->map = NULL;
+    } else if (st.st_size > 0 && mmap(file->map, st.st_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(file->map, file->size);
+        file->map = NULL;
+    }
+    int errnum = errno;
+    close(fd);
+
+    if (file->map == NULL) {
+        argfile_free(file);
+        err(str("cannot read '%s': %s", path, strerror(errnum)));
+    }
+
+    file->len = tokenize(file->map, &file->args, &file->max);
+    if (file->len < 0) {
+        argfile_free(file);
+        err(str("unterminated quote in '%s'", path));
     }
-    return false;
+
+    return file;
 }
 
 
@@ -652,15 +1298,19 @@ static void arglist_append(ArgList *list, char *arg) {
 }
 
 
-// Print the ArgList instance to stdout.
-static void arglist_print(ArgList *list) {
-    puts("Arguments:");
+// Append the ArgList instance to the buffer.
+static void arglist_render(ArgList *list, StrBuf *buf, int indent) {
+    strbuf_indent(buf, indent);
+    strbuf_puts(buf, "Arguments:\n");
     if (list->len > 0) {
         for (int i = 0; i < list->len; i++) {
-            printf("  %s\n", list->args[i]);
+            strbuf_indent(buf, indent + 2);
+            strbuf_puts(buf, list->args[i]);
+            strbuf_add(buf, "\n", 1);
         }
     } else {
-        puts("  [none]");
+        strbuf_indent(buf, indent + 2);
+        strbuf_puts(buf, "[none]\n");
     }
 }
 
@@ -675,23 +1325,81 @@ static void arglist_print(ArgList *list) {
 // ArgParser instance of its own. In theory commands can be stacked to any
 // depth, although in practice even two levels is confusing for users.
 typedef struct ArgParser {
+    char *name;
     char *helptext;
     char *version;
     Map *options;
     Map *commands;
     Map *callbacks;
+    Map *lazy;
     ArgList *arguments;
     char *cmd_name;
     ArgParser *cmd_parser;
     ArgParser *parent;
+    ArgFile *file;
+    ArgStream *stream;  // Innermost parse in progress, or NULL.
+    int depth;          // Number of parses in progress.
 } ArgParser;
 
 
+// A command registered with argparser_add_cmd_lazy(). Its parser is created
+// and populated by the init callback only when the command is needed.
+typedef struct LazyCmd {
+    char *name;
+    char *helptext;
+    CmdInitCB init;
+    CmdCB callback;
+    bool loaded;
+} LazyCmd;
+
+
+// Callback for freeing a LazyCmd instance stored in a Map.
+static void lazycmd_free_cb(void *lazy) {
+    free(((LazyCmd*)lazy)->name);
+    free(lazy);
+}
+
+
+// Free the files of earlier parses at the given depth or deeper, those are
+// over, while parses further up the stack may still use theirs.
+static void argparser_free_files(ArgParser *parser, int depth) {
+    while (parser->file != NULL && parser->file->depth >= depth) {
+        ArgFile *file = parser->file;
+        parser->file = file->prev;
+        argfile_free(file);
+    }
+}
+
+
+// Keep a file, or an expanded argument array, for the parse about to start.
+static void argparser_push_file(ArgParser *parser, ArgFile *file) {
+    file->depth = parser->depth;
+    file->prev = parser->file;
+    parser->file = file;
+}
+
+
+// Free the streams of parses that were left by a longjmp() out of a
+// command callback, down to the given depth.
+static void argparser_unwind(ArgParser *parser, int depth) {
+    while (parser->depth > depth) {
+        ArgStream *stream = parser->stream;
+        parser->stream = stream->prev;
+        parser->depth--;
+        argstream_free(stream);
+    }
+}
+
+
 // Free the memory associated with an ArgParser instance.
 static void argparser_free(ArgParser *parser) {
+    argparser_unwind(parser, 0);
+    argparser_free_files(parser, 0);
     map_free(parser->options);
     map_free(parser->commands);
     map_free(parser->callbacks);
+    map_free(parser->lazy);
+    free(parser->name);
     arglist_free(parser->arguments);
     free(parser);
 }
@@ -708,15 +1416,20 @@ static void argparser_free_cb(void *parser) {
 // --version flag. NULL can be passed for either parameter.
 static ArgParser* argparser_new(char *helptext, char *version) {
     ArgParser *parser = malloc(sizeof(ArgParser));
+    parser->name = NULL;
     parser->helptext = helptext;
     parser->version = version;
     parser->options = map_new(option_free_cb);
     parser->commands = map_new(argparser_free_cb);
     parser->callbacks = map_new(NULL);
+    parser->lazy = map_new(lazycmd_free_cb);
     parser->arguments = arglist_new();
     parser->cmd_name = NULL;
     parser->cmd_parser = NULL;
     parser->parent = NULL;
+    parser->file = NULL;
+    parser->stream = NULL;
+    parser->depth = 0;
     return parser;
 }
 
@@ -727,58 +1440,110 @@ static ArgParser* argparser_new(char *helptext, char *version) {
 
 
 // Register a boolean option with a default value of false.
-static void argparser_add_flag(ArgParser *parser, char *name) {
+static Option* argparser_add_flag(ArgParser *parser, char *name) {
     Option *opt = option_new_flag();
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register a string option with a default value.
-static void argparser_add_str(ArgParser *parser, char *name, char* value) {
+static Option* argparser_add_str(ArgParser *parser, char *name, char* value) {
     Option *opt = option_new_str(value);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register an integer option with a default value.
-static void argparser_add_int(ArgParser *parser, char *name, int value) {
+static Option* argparser_add_int(ArgParser *parser, char *name, int value) {
     Option *opt = option_new_int(value);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
+}
+
+
+// Register a choice option with the index of its default choice.
+static Option* argparser_add_choice(
+    ArgParser *parser, char *name, const char *const choices[], int value
+) {
+    Option *opt = option_new_choice(choices, value);
+    map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register a float option with a default value.
-static void argparser_add_float(ArgParser *parser, char *name, double value) {
+static Option* argparser_add_float(ArgParser *parser, char *name, double value) {
     Option *opt = option_new_float(value);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register a boolean list option.
-static void argparser_add_flag_list(ArgParser *parser, char *name) {
+static Option* argparser_add_flag_list(ArgParser *parser, char *name) {
     Option *opt = option_new_flag_list();
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register a string list option.
-static void argparser_add_str_list(ArgParser *parser, char *name, bool greedy) {
+static Option* argparser_add_str_list(ArgParser *parser, char *name, bool greedy) {
     Option *opt = option_new_str_list(greedy);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register an integer list option.
-static void argparser_add_int_list(ArgParser *parser, char *name, bool greedy) {
+static Option* argparser_add_int_list(ArgParser *parser, char *name, bool greedy) {
     Option *opt = option_new_int_list(greedy);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
 }
 
 
 // Register a floating-point list option.
-static void argparser_add_float_list(ArgParser *parser, char *name, bool greedy) {
+static Option* argparser_add_float_list(ArgParser *parser, char *name, bool greedy) {
     Option *opt = option_new_float_list(greedy);
     map_add_splitkey(parser->options, name, opt);
+    return opt;
+}
+
+
+// Register a boolean option bound to a variable. The variable's current
+// value is the default.
+static Option* argparser_bind_flag(ArgParser *parser, char *name, bool *var) {
+    Option *opt = argparser_add_flag(parser, name);
+    FLAG_VALUES(opt)[0] = *var;
+    opt->bind = var;
+    return opt;
+}
+
+
+// Register a string option bound to a variable.
+static Option* argparser_bind_str(ArgParser *parser, char *name, char **var) {
+    Option *opt = argparser_add_str(parser, name, *var);
+    opt->bind = var;
+    return opt;
+}
+
+
+// Register an integer option bound to a variable.
+static Option* argparser_bind_int(ArgParser *parser, char *name, int *var) {
+    Option *opt = argparser_add_int(parser, name, *var);
+    opt->bind = var;
+    return opt;
+}
+
+
+// Register a floating-point option bound to a variable.
+static Option* argparser_bind_float(ArgParser *parser, char *name, double *var) {
+    Option *opt = argparser_add_float(parser, name, *var);
+    opt->bind = var;
+    return opt;
 }
 
 
@@ -792,7 +1557,7 @@ static Option* argparser_get_opt(ArgParser *parser, char *name) {
     Option *opt = map_get(parser->options, name);
     if (opt == NULL) {
         fprintf(stderr, "Abort: '%s' is not a registered option.\n", name);
-        exit(1);
+        argparser_exit(1);
     }
     return opt;
 }
@@ -979,6 +1744,7 @@ static ArgParser* argparser_add_cmd(
     ArgParser *parser, char *name, char *helptext, CmdCB callback
 ) {
     ArgParser *cmd_parser = argparser_new(helptext, NULL);
+    cmd_parser->name = str_dup(name);
     cmd_parser->parent = parser;
     map_add_splitkey(parser->commands, name, cmd_parser);
     map_add_splitkey(parser->callbacks, name, callback);
@@ -986,6 +1752,61 @@ static ArgParser* argparser_add_cmd(
 }
 
 
+// Register a command whose parser is only created when the command is first
+// matched, or its help text is asked for. The init callback receives the
+// new parser and registers the command's options and subcommands.
+static void argparser_add_cmd_lazy(
+    ArgParser *parser, char *name, char *helptext, CmdInitCB init, CmdCB callback
+) {
+    LazyCmd *lazy = malloc(sizeof(LazyCmd));
+    lazy->name = str_dup(name);
+    lazy->helptext = helptext;
+    lazy->init = init;
+    lazy->callback = callback;
+    lazy->loaded = false;
+    map_add_splitkey(parser->lazy, name, lazy);
+}
+
+
+// Returns the parser of the named command, creating it first if the command
+// was registered lazily, or NULL if there is no such command.
+static ArgParser* argparser_find_cmd(ArgParser *parser, char *name) {
+    ArgParser *cmd_parser = map_get(parser->commands, name);
+    if (cmd_parser != NULL) {
+        return cmd_parser;
+    }
+
+    LazyCmd *lazy = map_get(parser->lazy, name);
+    if (lazy == NULL || lazy->loaded) {
+        return NULL;
+    }
+
+    cmd_parser = argparser_add_cmd(parser, lazy->name, lazy->helptext, lazy->callback);
+    lazy->loaded = true;
+    lazy->init(cmd_parser);
+    return cmd_parser;
+}
+
+
+// Returns true if any of the space-separated names in the keystring is
+// already registered as a command, without creating lazy parsers.
+static bool argparser_cmd_exists(ArgParser *parser, char *name) {
+    char *key;
+    char *saveptr;
+    char *name_cpy = str_dup(name);
+    bool found = false;
+
+    key = strtok_r(name_cpy, " ", &saveptr);
+    while (key != NULL && !found) {
+        found = map_contains(parser->commands, key) || map_contains(parser->lazy, key);
+        key = strtok_r(NULL, " ", &saveptr);
+    }
+
+    free(name_cpy);
+    return found;
+}
+
+
 // Returns true if the parser has found a command.
 static bool argparser_has_cmd(ArgParser *parser) {
     return parser->cmd_name != NULL;
@@ -1010,51 +1831,52 @@ static ArgParser* argparser_get_parent(ArgParser *parser) {
 }
 
 
+// Returns the name string a command parser was registered with.
+static char* argparser_get_name(ArgParser *parser) {
+    return parser->name;
+}
+
+
 // -------------------------------------------------------------------------
 // ArgParser: parse arguments.
 // -------------------------------------------------------------------------
 
 
-// Parse an option of the form --name=value or -n=value.
+// Parse an option of the form --name=value or -n=value. The name is the
+// len bytes before the '=', the value is looked up in place.
 static void argparser_parse_equals_option(
-    ArgParser *parser, char *prefix, char *arg
+    ArgParser *parser, char *prefix, char *arg, int len
 ) {
-    char *name = str_dup(arg);
-    *strchr(name, '=') = '\0';
-    char *value = strchr(arg, '=') + 1;
+    char *value = arg + len + 1;
 
     // Do we have the name of a registered option?
-    Option *opt = map_get(parser->options, name);
+    Option *opt = map_get_len(parser->options, arg, len);
     if (opt == NULL) {
-        err(str("%s%s is not a recognised option", prefix, name));
+        err(str("%s%.*s is not a recognised option", prefix, len, arg));
     }
     opt->found = true;
 
     // Boolean flags can never contain an equals sign.
     if (opt->type == FLAG) {
-        err(str("invalid format for boolean flag %s%s", prefix, name));
+        err(str("invalid format for boolean flag %s%.*s", prefix, len, arg));
     }
 
     // Check that a value has been supplied.
-    if (strlen(value) == 0) {
-        err(str("missing argument for the %s%s option", prefix, name));
+    if (*value == '\0') {
+        err(str("missing argument for the %s%.*s option", prefix, len, arg));
     }
 
     option_try_set(opt, value);
-
-    // The map stores a copy of the name as its key so we can safely free
-    // the memory used by our duplicated argument string.
-    free(name);
 }
 
 
 // Parse a long-form option, i.e. an option beginning with a double dash.
 static void argparser_parse_long_option(
-    ArgParser *parser, char *arg, ArgStream *stream
+    ArgParser *parser, char *arg, ArgInfo info, ArgStream *stream
 ) {
     // Do we have an option of the form --name=value?
-    if (strstr(arg, "=") != NULL) {
-        argparser_parse_equals_option(parser, "--", arg);
+    if (info.eq != 0) {
+        argparser_parse_equals_option(parser, "--", arg, info.eq - 2);
     }
 
     // Is the argument a registered option name?
@@ -1091,13 +1913,13 @@ static void argparser_parse_long_option(
     // Is the argument the automatic --help flag?
     else if (strcmp(arg, "help") == 0 && parser->helptext != NULL) {
         puts(parser->helptext);
-        exit(0);
+        argparser_exit(0);
     }
 
     // Is the argument the automatic --version flag?
     else if (strcmp(arg, "version") == 0 && parser->version != NULL) {
         puts(parser->version);
-        exit(0);
+        argparser_exit(0);
     }
 
     // The argument is not a registered or automatic option name.
@@ -1110,11 +1932,11 @@ static void argparser_parse_long_option(
 
 // Parse a short-form option, i.e. an option beginning with a single dash.
 static void argparser_parse_short_option(
-    ArgParser *parser, char *arg, ArgStream *stream
+    ArgParser *parser, char *arg, ArgInfo info, ArgStream *stream
 ) {
     // Do we have an option of the form -n=value?
-    if (strstr(arg, "=") != NULL) {
-        argparser_parse_equals_option(parser, "-", arg);
+    if (info.eq != 0) {
+        argparser_parse_equals_option(parser, "-", arg, info.eq - 1);
         return;
     }
 
@@ -1122,7 +1944,7 @@ static void argparser_parse_short_option(
     //    -abc foo bar
     // is equivalent to:
     //    -a foo -b bar -c
-    for (size_t i = 0; i < strlen(arg); i++) {
+    for (unsigned int i = 0; i < info.len - 1; i++) {
 
         // Do we have the name of a registered option?
         char key[] = {arg[i], 0};
@@ -1170,8 +1992,10 @@ static void argparser_parse_stream(ArgParser *parser, ArgStream *stream) {
     // Loop while we have arguments to process.
     while (argstream_has_next(stream)) {
 
-        // Fetch the next argument from the stream.
+        // Fetch the next argument from the stream, it was classified when
+        // the stream was created.
         char *arg = argstream_next(stream);
+        ArgInfo info = argstream_info(stream);
 
         // If parsing has been turned off, simply add the argument to the list
         // of positionals.
@@ -1181,36 +2005,40 @@ static void argparser_parse_stream(ArgParser *parser, ArgStream *stream) {
         }
 
         // If we encounter a '--' argument, turn off option-parsing.
-        if (strcmp(arg, "--") == 0) {
+        if (info.kind == ARG_DASHDASH) {
             parsing = false;
             continue;
         }
 
         // Is the argument a long-form option or flag?
-        else if (strncmp(arg, "--", 2) == 0) {
-            argparser_parse_long_option(parser, arg + 2, stream);
+        else if (info.kind == ARG_LONG) {
+            argparser_parse_long_option(parser, arg + 2, info, stream);
         }
 
-        // Is the argument a short-form option or flag? If the argument
-        // consists of a single dash or a dash followed by a digit, we treat
-        // it as a positional argument.
-        else if (arg[0] == '-') {
-            if (strlen(arg) == 1 || isdigit(arg[1])) {
-                arglist_append(parser->arguments, arg);
-            } else {
-                argparser_parse_short_option(parser, arg + 1, stream);
-            }
+        // Is the argument a short-form option or flag? A single dash or a
+        // dash followed by a digit is classified as a positional argument.
+        else if (info.kind == ARG_SHORT) {
+            argparser_parse_short_option(parser, arg + 1, info, stream);
+        }
+
+        // Is the argument a negative number? Treat it as a positional.
+        else if (info.kind == ARG_NUMBER) {
+            arglist_append(parser->arguments, arg);
         }
 
         // Is the argument a registered command?
-        else if (map_contains(parser->commands, arg)) {
+        else if (argparser_find_cmd(parser, arg) != NULL) {
             ArgParser *cmd_parser = map_get(parser->commands, arg);
             CmdCB cmd_callback = map_get(parser->callbacks, arg);
             parser->cmd_name = arg;
             parser->cmd_parser = cmd_parser;
             argparser_parse_stream(cmd_parser, stream);
             if (cmd_callback != NULL) {
-                cmd_callback(cmd_parser);
+                if (cmd_hook != NULL) {
+                    cmd_hook(cmd_parser, cmd_callback);
+                } else {
+                    cmd_callback(cmd_parser);
+                }
             }
         }
 
@@ -1223,10 +2051,10 @@ static void argparser_parse_stream(ArgParser *parser, ArgStream *stream) {
         else if (strcmp(arg, "help") == 0) {
             if (argstream_has_next(stream)) {
                 char *name = argstream_next(stream);
-                if (map_contains(parser->commands, name)) {
-                    ArgParser *cmd_parser = map_get(parser->commands, name);
+                ArgParser *cmd_parser = argparser_find_cmd(parser, name);
+                if (cmd_parser != NULL) {
                     puts(cmd_parser->helptext);
-                    exit(0);
+                    argparser_exit(0);
                 } else {
                     err(str("'%s' is not a recognised command", name));
                 }
@@ -1243,11 +2071,97 @@ static void argparser_parse_stream(ArgParser *parser, ArgStream *stream) {
 }
 
 
-// Parse an array of string arguments.
+// Parse an array of string arguments. The stream is kept on the parser
+// while in use, so it can be freed if a callback never returns.
 static void argparser_parse(ArgParser *parser, int len, char *args[]) {
     ArgStream *stream = argstream_new(len, args);
+    stream->prev = parser->stream;
+    parser->stream = stream;
+    parser->depth++;
     argparser_parse_stream(parser, stream);
-    argstream_free(stream);
+    argparser_unwind(parser, parser->depth - 1);
+}
+
+
+// Parse the arguments in a file. The file stays mapped until the next file
+// is parsed at the same depth or the parser is freed, as string values
+// point into it.
+static void argparser_parse_file(ArgParser *parser, char *path) {
+    argparser_free_files(parser, parser->depth);
+    ArgFile *file = argfile_load(path);
+    argparser_push_file(parser, file);
+    argparser_parse(parser, file->len - 1, file->args + 1);
+}
+
+
+// Returns true if the argument is of the form @FILE.
+static bool is_file_arg(const char *arg) {
+    return arg[0] == '@' && arg[1] != '\0';
+}
+
+
+// Parse an array of arguments in which each @FILE before any "--" stands
+// for the arguments in FILE. The files and the expanded array are kept as
+// with argparser_parse_file().
+static void argparser_parse_files(ArgParser *parser, int len, char *args[]) {
+    argparser_free_files(parser, parser->depth);
+
+    int first = 0;
+    while (first < len && strcmp(args[first], "--") != 0 && !is_file_arg(args[first])) {
+        first++;
+    }
+    if (first == len || !is_file_arg(args[first])) {
+        argparser_parse(parser, len, args);
+        return;
+    }
+
+    // Registered before any file is loaded, so it is freed if one fails.
+    ArgFile *list = calloc(1, sizeof(ArgFile));
+    list->max = len;
+    list->args = malloc(list->max * sizeof(char*));
+    argparser_push_file(parser, list);
+    memcpy(list->args, args, first * sizeof(char*));
+    list->len = first;
+
+    bool dashdash = false;
+    for (int i = first; i < len; i++) {
+        if (dashdash || !is_file_arg(args[i])) {
+            dashdash = dashdash || strcmp(args[i], "--") == 0;
+            list->args[list->len++] = args[i];
+            continue;
+        }
+
+        ArgFile *file = argfile_load(args[i] + 1);
+        argparser_push_file(parser, file);
+
+        int need = list->len + (file->len - 1) + (len - i - 1);
+        if (need > list->max) {
+            list->max = need;
+            list->args = realloc(list->args, list->max * sizeof(char*));
+        }
+        memcpy(&list->args[list->len], file->args + 1, (file->len - 1) * sizeof(char*));
+        list->len += file->len - 1;
+    }
+
+    argparser_parse(parser, list->len, list->args);
+}
+
+
+// Reset a parser, and recursively all of its command parsers, to the state
+// it was in before parsing so that it can be reused for a new set of
+// arguments. Options are restored to their default values.
+static void argparser_reset(ArgParser *parser) {
+    for (int i = 0; i < parser->options->len; i++) {
+        option_reset(map_value_at_index(parser->options, i));
+    }
+
+    for (int i = 0; i < parser->commands->len; i++) {
+        argparser_reset(map_value_at_index(parser->commands, i));
+    }
+
+    parser->arguments->len = 0;
+    parser->cmd_name = NULL;
+    parser->cmd_parser = NULL;
 }
 
 
@@ -1256,30 +2170,107 @@ static void argparser_parse(ArgParser *parser, int len, char *args[]) {
 // -------------------------------------------------------------------------
 
 
-// Print a parser instance to stdout.
-static void argparser_print(ArgParser *parser) {
-    puts("Options:");
+// Append a parser instance's options, arguments and command as text. With
+// recurse set the command's own parser follows, indented.
+static void argparser_render_text(
+    ArgParser *parser, StrBuf *buf, int indent, bool recurse
+) {
+    strbuf_indent(buf, indent);
+    strbuf_puts(buf, "Options:\n");
     if (parser->options->len > 0) {
         for (int i = 0; i < parser->options->len; i++) {
-            char *name = map_key_at_index(parser->options, i);
-            Option *opt = map_value_at_index(parser->options, i);
-            char *optstr = option_str(opt);
-            printf("  %s: %s\n", name, optstr);
-            free(optstr);
+            strbuf_indent(buf, indent + 2);
+            strbuf_puts(buf, map_key_at_index(parser->options, i));
+            strbuf_puts(buf, ": ");
+            option_render(map_value_at_index(parser->options, i), buf, AP_TEXT);
+            strbuf_add(buf, "\n", 1);
+        }
+    } else {
+        strbuf_indent(buf, indent + 2);
+        strbuf_puts(buf, "[none]\n");
+    }
+    strbuf_add(buf, "\n", 1);
+
+    arglist_render(parser->arguments, buf, indent);
+
+    strbuf_add(buf, "\n", 1);
+    strbuf_indent(buf, indent);
+    strbuf_puts(buf, "Command:\n");
+    strbuf_indent(buf, indent + 2);
+    if (argparser_has_cmd(parser)) {
+        strbuf_puts(buf, argparser_get_cmd_name(parser));
+        strbuf_add(buf, "\n", 1);
+        if (recurse) {
+            strbuf_add(buf, "\n", 1);
+            argparser_render_text(parser->cmd_parser, buf, indent + 4, true);
         }
     } else {
-        puts("  [none]");
+        strbuf_puts(buf, "[none]\n");
+    }
+}
+
+
+// Append a parser instance, and the parser of the command it found, as a
+// JSON object.
+static void argparser_render_json(ArgParser *parser, StrBuf *buf) {
+    strbuf_puts(buf, "{\"options\":{");
+    for (int i = 0; i < parser->options->len; i++) {
+        Option *opt = map_value_at_index(parser->options, i);
+
+        if (i > 0) {
+            strbuf_add(buf, ",", 1);
+        }
+        strbuf_json_str(buf, map_key_at_index(parser->options, i));
+        strbuf_printf(buf, ":{\"found\":%s,\"values\":", opt->found ? "true" : "false");
+        option_render(opt, buf, AP_JSON);
+        strbuf_add(buf, "}", 1);
     }
-    puts("");
 
-    arglist_print(parser->arguments);
+    strbuf_puts(buf, "},\"arguments\":[");
+    for (int i = 0; i < parser->arguments->len; i++) {
+        if (i > 0) {
+            strbuf_add(buf, ",", 1);
+        }
+        strbuf_json_str(buf, parser->arguments->args[i]);
+    }
 
-    puts("\nCommand:");
+    strbuf_puts(buf, "],\"command\":");
     if (argparser_has_cmd(parser)) {
-        printf("  %s\n", argparser_get_cmd_name(parser));
+        strbuf_puts(buf, "{\"name\":");
+        strbuf_json_str(buf, argparser_get_cmd_name(parser));
+        strbuf_puts(buf, ",\"parser\":");
+        argparser_render_json(parser->cmd_parser, buf);
+        strbuf_add(buf, "}", 1);
+    } else {
+        strbuf_puts(buf, "null");
+    }
+    strbuf_add(buf, "}", 1);
+}
+
+
+// Print a parser instance to stdout.
+static void argparser_print(ArgParser *parser) {
+    StrBuf buf = {0};
+
+    argparser_render_text(parser, &buf, 0, false);
+    fwrite(buf.data, 1, buf.len, stdout);
+    free(buf.data);
+}
+
+
+// Write a parser instance's full parse state, following the chain of found
+// commands, to a stream as text or as a single line of JSON.
+static void argparser_dump(ArgParser *parser, FILE *stream, ApFormat format) {
+    StrBuf buf = {0};
+
+    if (format == AP_JSON) {
+        argparser_render_json(parser, &buf);
+        strbuf_add(&buf, "\n", 1);
     } else {
-        puts("  [none]");
+        argparser_render_text(parser, &buf, 0, true);
     }
+    fwrite(buf.data, 1, buf.len, stream);
+    free(buf.data);
 }
 
 
@@ -1303,43 +2294,110 @@ void ap_parse(ArgParser *parser, int argc, char *argv[]) {
 }
 
 
-void ap_add_flag(ArgParser *parser, char *name) {
-    argparser_add_flag(parser, name);
+int ap_tokenize(char *str, char ***argv, int *max) {
+    return tokenize(str, argv, max);
+}
+
+
+void ap_parse_file(ArgParser *parser, char *path) {
+    argparser_parse_file(parser, path);
+}
+
+
+void ap_parse_files(ArgParser *parser, int argc, char *argv[]) {
+    argparser_parse_files(parser, argc - 1, argv + 1);
+}
+
+
+void ap_reset(ArgParser *parser) {
+    argparser_reset(parser);
+}
+
+
+int ap_parse_depth(ArgParser *parser) {
+    return parser->depth;
+}
+
+
+void ap_unwind(ArgParser *parser, int depth) {
+    argparser_unwind(parser, depth);
+}
+
+
+void ap_set_exit_cb(void (*cb)(int status)) {
+    exit_cb = cb;
+}
+
+
+void ap_set_cmd_hook(void (*hook)(ArgParser *parser, void (*cb)(ArgParser *parser))) {
+    cmd_hook = hook;
+}
+
+
+ApOpt* ap_add_flag(ArgParser *parser, char *name) {
+    return argparser_add_flag(parser, name);
+}
+
+
+ApOpt* ap_add_str(ArgParser *parser, char *name, char* value) {
+    return argparser_add_str(parser, name, value);
+}
+
+
+ApOpt* ap_add_int(ArgParser *parser, char *name, int value) {
+    return argparser_add_int(parser, name, value);
+}
+
+
+ApOpt* ap_add_float(ArgParser *parser, char *name, double value) {
+    return argparser_add_float(parser, name, value);
+}
+
+
+ApOpt* ap_add_choice(
+    ArgParser *parser, char *name, const char *const choices[], int value
+) {
+    return argparser_add_choice(parser, name, choices, value);
+}
+
+
+ApOpt* ap_add_flag_list(ArgParser *parser, char *name) {
+    return argparser_add_flag_list(parser, name);
 }
 
 
-void ap_add_str(ArgParser *parser, char *name, char* value) {
-    argparser_add_str(parser, name, value);
+ApOpt* ap_add_str_list(ArgParser *parser, char *name, bool greedy) {
+    return argparser_add_str_list(parser, name, greedy);
 }
 
 
-void ap_add_int(ArgParser *parser, char *name, int value) {
-    argparser_add_int(parser, name, value);
+ApOpt* ap_add_int_list(ArgParser *parser, char *name, bool greedy) {
+    return argparser_add_int_list(parser, name, greedy);
 }
 
 
-void ap_add_float(ArgParser *parser, char *name, double value) {
-    argparser_add_float(parser, name, value);
+ApOpt* ap_add_float_list(ArgParser *parser, char *name, bool greedy) {
+    return argparser_add_float_list(parser, name, greedy);
 }
 
 
-void ap_add_flag_list(ArgParser *parser, char *name) {
-    argparser_add_flag_list(parser, name);
+ApOpt* ap_bind_flag(ArgParser *parser, char *name, bool *var) {
+    return argparser_bind_flag(parser, name, var);
 }
 
 
-void ap_add_str_list(ArgParser *parser, char *name, bool greedy) {
-    argparser_add_str_list(parser, name, greedy);
+ApOpt* ap_bind_str(ArgParser *parser, char *name, char **var) {
+    return argparser_bind_str(parser, name, var);
 }
 
 
-void ap_add_int_list(ArgParser *parser, char *name, bool greedy) {
-    argparser_add_int_list(parser, name, greedy);
+ApOpt* ap_bind_int(ArgParser *parser, char *name, int *var) {
+    return argparser_bind_int(parser, name, var);
 }
 
 
-void ap_add_float_list(ArgParser *parser, char *name, bool greedy) {
-    argparser_add_float_list(parser, name, greedy);
+ApOpt* ap_bind_float(ArgParser *parser, char *name, double *var) {
+    return argparser_bind_float(parser, name, var);
 }
 
 
@@ -1423,6 +2481,86 @@ void ap_set_float(ArgParser *parser, char *name, double value) {
 }
 
 
+bool ap_opt_found(ApOpt *opt) {
+    return opt->found;
+}
+
+
+bool ap_opt_get_flag(ApOpt *opt) {
+    return option_get_flag(opt);
+}
+
+
+char* ap_opt_get_str(ApOpt *opt) {
+    return option_get_str(opt);
+}
+
+
+int ap_opt_get_int(ApOpt *opt) {
+    return option_get_int(opt);
+}
+
+
+double ap_opt_get_float(ApOpt *opt) {
+    return option_get_float(opt);
+}
+
+
+int ap_opt_len_list(ApOpt *opt) {
+    return opt->len;
+}
+
+
+bool* ap_opt_get_flag_list(ApOpt *opt) {
+    return option_get_flag_list(opt);
+}
+
+
+char** ap_opt_get_str_list(ApOpt *opt) {
+    return option_get_str_list(opt);
+}
+
+
+int* ap_opt_get_int_list(ApOpt *opt) {
+    return option_get_int_list(opt);
+}
+
+
+double* ap_opt_get_float_list(ApOpt *opt) {
+    return option_get_float_list(opt);
+}
+
+
+const void* ap_opt_list_data(ApOpt *opt) {
+    return opt->values;
+}
+
+
+void ap_opt_clear_list(ApOpt *opt) {
+    option_clear(opt);
+}
+
+
+void ap_opt_set_flag(ApOpt *opt, bool value) {
+    option_set_flag(opt, value);
+}
+
+
+void ap_opt_set_str(ApOpt *opt, char *value) {
+    option_set_str(opt, value);
+}
+
+
+void ap_opt_set_int(ApOpt *opt, int value) {
+    option_set_int(opt, value);
+}
+
+
+void ap_opt_set_float(ApOpt *opt, double value) {
+    option_set_float(opt, value);
+}
+
+
 bool ap_has_args(ArgParser *parser) {
     return argparser_has_args(parser);
 }
@@ -1453,6 +2591,19 @@ double* ap_get_args_as_floats(ArgParser *parser) {
 }
 
 
+void ap_add_cmd_lazy(
+    ArgParser *parser, char *name, char *help,
+    void (*init)(ArgParser *parser), CmdCB cb
+) {
+    argparser_add_cmd_lazy(parser, name, help, init, cb);
+}
+
+
+bool ap_cmd_exists(ArgParser *parser, char *name) {
+    return argparser_cmd_exists(parser, name);
+}
+
+
 bool ap_has_cmd(ArgParser *parser) {
     return argparser_has_cmd(parser);
 }
@@ -1473,6 +2624,16 @@ ArgParser* ap_get_parent(ArgParser *parser) {
 }
 
 
+char* ap_get_name(ArgParser *parser) {
+    return argparser_get_name(parser);
+}
+
+
 void ap_print(ArgParser *parser) {
     argparser_print(parser);
 }
+
+
+void ap_dump(ArgParser *parser, FILE *stream, ApFormat format) {
+    argparser_dump(parser, stream, format);
+}
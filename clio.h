@@ -11,6 +11,7 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdio.h>
 
 
 // -------------------------------------------------------------------------
@@ -22,6 +23,17 @@
 // ArgParser instance of its own.
 typedef struct ArgParser ArgParser;
 
+// An ApOpt is a handle to a registered option, returned when the option is
+// registered. It stays valid until the parser is freed and gives direct
+// access to the option's values without looking up its name.
+typedef struct Option ApOpt;
+
+// Output formats for ap_dump().
+typedef enum ApFormat {
+    AP_TEXT,
+    AP_JSON,
+} ApFormat;
+
 
 // -------------------------------------------------------------------------
 // ArgParser initialization and teardown.
@@ -45,34 +57,103 @@ void ap_free(ArgParser *parser);
 // element of the array is assumed to be the program name and ignored.
 void ap_parse(ArgParser *parser, int argc, char **argv);
 
+// Split a string into arguments in place, shell-like: arguments are
+// separated by whitespace, single quotes preserve everything up to the
+// closing quote, within double quotes a backslash escapes '"' and itself,
+// elsewhere it escapes any character or joins two lines, and a '#' at the
+// start of an argument comments out the rest of the line. The arguments
+// are stored from (*argv)[1] on, followed by NULL, (*argv)[0] is left for
+// the caller, so the result can be passed to ap_parse(). The array is
+// grown as needed, *max holds its size, and can be reused across calls.
+// Returns the argument count including (*argv)[0], or -1 on an
+// unterminated quote.
+int ap_tokenize(char *str, char ***argv, int *max);
+
+// Parse the arguments in a file, tokenized as by ap_tokenize(). The file is
+// split in place and stays mapped until the next call, other than from a
+// command callback of this parse, or until the parser is freed.
+void ap_parse_file(ArgParser *parser, char *path);
+
+// Like ap_parse(), but each argument of the form @FILE before any "--" is
+// replaced by the arguments in FILE, read as by ap_parse_file(). Arguments
+// read from a file are not expanded again.
+void ap_parse_files(ArgParser *parser, int argc, char **argv);
+
+// Reset a parser and all its command parsers to their pre-parsing state so
+// the same instance can be used to parse a new array of arguments. Options
+// are restored to their default values.
+void ap_reset(ArgParser *parser);
+
+// Returns the number of parses in progress on the parser: a command callback
+// may call ap_parse() again, e.g. to run commands read from a file.
+int ap_parse_depth(ArgParser *parser);
+
+// Free what the parses in progress above the given depth allocated. To be
+// called when the exit callback or a command callback longjmp()s out of
+// ap_parse(), with the depth from before the call.
+void ap_unwind(ArgParser *parser, int depth);
+
+// Register a callback to be invoked instead of exit() when parsing fails or
+// after printing --help or --version output. The callback receives the exit
+// status and is not expected to return, e.g. it may longjmp() back to the
+// caller. If it does return, the process exits.
+void ap_set_exit_cb(void (*cb)(int status));
+
+// Register a hook to be invoked in place of each command callback. The hook
+// receives the command's ArgParser instance and its callback, and decides
+// when, where and how many times to run it, e.g. once per worker thread.
+void ap_set_cmd_hook(void (*hook)(ArgParser *parser, void (*cb)(ArgParser *parser)));
+
 
 // -------------------------------------------------------------------------
 // Registering options.
 // -------------------------------------------------------------------------
 
+// The registration functions return a handle to the new option, see the
+// ap_opt_* functions below.
+
 // Register a boolean option.
-void ap_add_flag(ArgParser *parser, char *name);
+ApOpt* ap_add_flag(ArgParser *parser, char *name);
 
 // Register a string option with a default value.
-void ap_add_str(ArgParser *parser, char *name, char* value);
+ApOpt* ap_add_str(ArgParser *parser, char *name, char* value);
 
 // Register an integer option with a default value.
-void ap_add_int(ArgParser *parser, char *name, int value);
+ApOpt* ap_add_int(ArgParser *parser, char *name, int value);
 
 // Register a floating-point option with a default value.
-void ap_add_float(ArgParser *parser, char *name, double value);
+ApOpt* ap_add_float(ArgParser *parser, char *name, double value);
+
+// Register an option whose value must be one of a NULL-terminated array of
+// choices, which must stay valid as long as the parser. The option stores
+// the index of the choice given, read with ap_get_int() or ap_opt_get_int(),
+// so callbacks can switch on it. The default is an index too, or -1.
+ApOpt* ap_add_choice(
+    ArgParser *parser, char *name, const char *const choices[], int value
+);
 
 // Register a boolean list option.
-void ap_add_flag_list(ArgParser *parser, char *name);
+ApOpt* ap_add_flag_list(ArgParser *parser, char *name);
 
 // Register a string list option.
-void ap_add_str_list(ArgParser *parser, char *name, bool greedy);
+ApOpt* ap_add_str_list(ArgParser *parser, char *name, bool greedy);
 
 // Register an integer list option.
-void ap_add_int_list(ArgParser *parser, char *name, bool greedy);
+ApOpt* ap_add_int_list(ArgParser *parser, char *name, bool greedy);
 
 // Register a floating-point list option.
-void ap_add_float_list(ArgParser *parser, char *name, bool greedy);
+ApOpt* ap_add_float_list(ArgParser *parser, char *name, bool greedy);
+
+
+// Register an option bound to a variable, e.g. a member of a config struct.
+// The variable's current value is the option's default. The parser writes
+// each value it finds straight to the variable, and ap_reset() restores the
+// default, so a command callback can read its options without a lookup.
+
+ApOpt* ap_bind_flag(ArgParser *parser, char *name, bool *var);
+ApOpt* ap_bind_str(ArgParser *parser, char *name, char **var);
+ApOpt* ap_bind_int(ArgParser *parser, char *name, int *var);
+ApOpt* ap_bind_float(ArgParser *parser, char *name, double *var);
 
 
 // -------------------------------------------------------------------------
@@ -134,6 +215,38 @@ void ap_set_int(ArgParser *parser, char *name, int value);
 void ap_set_float(ArgParser *parser, char *name, double value);
 
 
+// -------------------------------------------------------------------------
+// Option handles.
+// -------------------------------------------------------------------------
+
+// These work like the functions above but take the handle returned when
+// the option was registered, so no name lookup is needed. Useful in
+// command callbacks that run many times, e.g. once per line of a batch.
+
+bool ap_opt_found(ApOpt *opt);
+bool ap_opt_get_flag(ApOpt *opt);
+char* ap_opt_get_str(ApOpt *opt);
+int ap_opt_get_int(ApOpt *opt);
+double ap_opt_get_float(ApOpt *opt);
+
+int ap_opt_len_list(ApOpt *opt);
+bool* ap_opt_get_flag_list(ApOpt *opt);
+char** ap_opt_get_str_list(ApOpt *opt);
+int* ap_opt_get_int_list(ApOpt *opt);
+double* ap_opt_get_float_list(ApOpt *opt);
+
+// Returns the option's own array of values, a bool[], char*[], int[] or
+// double[] depending on its type, without copying. The array holds
+// ap_opt_len_list() values and is only valid until the option changes.
+const void* ap_opt_list_data(ApOpt *opt);
+
+void ap_opt_clear_list(ApOpt *opt);
+void ap_opt_set_flag(ApOpt *opt, bool value);
+void ap_opt_set_str(ApOpt *opt, char *value);
+void ap_opt_set_int(ApOpt *opt, int value);
+void ap_opt_set_float(ApOpt *opt, double value);
+
+
 // -------------------------------------------------------------------------
 // Positional arguments.
 // -------------------------------------------------------------------------
@@ -173,6 +286,19 @@ ArgParser* ap_add_cmd(
     ArgParser *parser, char *name, char *help, void (*cb)(ArgParser *parser)
 );
 
+// Register a command whose parser is only created when the command is
+// matched while parsing, or its help text is asked for. The init callback
+// then receives the new parser and registers the command's options and
+// subcommands, so start-up cost depends only on the commands actually used.
+void ap_add_cmd_lazy(
+    ArgParser *parser, char *name, char *help,
+    void (*init)(ArgParser *parser), void (*cb)(ArgParser *parser)
+);
+
+// Returns true if any of the space-separated names in the string is already
+// registered as a command of the parser, lazily or not.
+bool ap_cmd_exists(ArgParser *parser, char *name);
+
 // Returns true if the parser has found a command.
 bool ap_has_cmd(ArgParser *parser);
 
@@ -185,6 +311,10 @@ ArgParser* ap_get_cmd_parser(ArgParser *parser);
 // Returns a command parser's parent parser.
 ArgParser* ap_get_parent(ArgParser *parser);
 
+// Returns the name string a command parser was registered with, including
+// any aliases, e.g. "del delete". Returns NULL for the root parser.
+char* ap_get_name(ArgParser *parser);
+
 
 // -------------------------------------------------------------------------
 // Utilities.
@@ -192,3 +322,8 @@ ArgParser* ap_get_parent(ArgParser *parser);
 
 // Print a parser instance to stdout.
 void ap_print(ArgParser *parser);
+
+// Write the full parse state of a parser instance to a stream: options,
+// positional arguments and, recursively, the command found and its parser.
+// The output is rendered into a single buffer and written in one go.
+void ap_dump(ArgParser *parser, FILE *stream, ApFormat format);
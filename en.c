@@ -1,26 +1,586 @@
 #include <err.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
 
-#include "clio.h"
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP	0x10000
+#define IFF_DORMANT	0x20000
+#define IFF_ECHO	0x40000
+#endif
+
+static const struct {
+	unsigned int flag;
+	const char  *name;
+} ifflags[] = {
+	{ IFF_LOOPBACK,    "LOOPBACK"    },
+	{ IFF_BROADCAST,   "BROADCAST"   },
+	{ IFF_POINTOPOINT, "POINTOPOINT" },
+	{ IFF_MULTICAST,   "MULTICAST"   },
+	{ IFF_NOARP,       "NOARP"       },
+	{ IFF_ALLMULTI,    "ALLMULTI"    },
+	{ IFF_PROMISC,     "PROMISC"     },
+	{ IFF_MASTER,      "MASTER"      },
+	{ IFF_SLAVE,       "SLAVE"       },
+	{ IFF_DEBUG,       "DEBUG"       },
+	{ IFF_DYNAMIC,     "DYNAMIC"     },
+	{ IFF_AUTOMEDIA,   "AUTOMEDIA"   },
+	{ IFF_PORTSEL,     "PORTSEL"     },
+	{ IFF_NOTRAILERS,  "NOTRAILERS"  },
+	{ IFF_UP,          "UP"          },
+	{ IFF_LOWER_UP,    "LOWER_UP"    },
+	{ IFF_DORMANT,     "DORMANT"     },
+	{ IFF_ECHO,        "ECHO"        },
+};
+
+static const char *operstates[] = {
+	"unknown", "notpresent", "down", "lowerlayerdown",
+	"testing", "dormant", "up"
+};
+
+/* Per thread, each worker runs a command in its own network namespace */
+static __thread struct nl  *rtnl;
+static __thread struct nl  *genl;
+static __thread jmp_buf    *en_jmp;
+static __thread const char *en_tag;
+static __thread const char *en_label;
+static __thread char        en_errmsg[512];	/* Last error, see en_error() */
+static bool                 sticky_json;
+
+/* Global options, filled in by the parser */
+static struct {
+	bool                json;
+	char               *batch;
+	bool                server;
+} opts;
+static ApOpt               *opt_json;
+
+/*
+ * All errors end up here.  When running several commands from the same
+ * process, see en_run(), we recover and carry on with the next one.
+ */
+void en_exit(int status)
+{
+	if (!en_jmp)
+		exit(status);
+
+	/* Dump aborted half-way, replies still queued on the socket */
+	if (rtnl && rtnl->busy) {
+		nl_close(rtnl);
+		rtnl = NULL;
+	}
+	if (genl && genl->busy) {
+		nl_close(genl);
+		genl = NULL;
+	}
+	json_reset();
+	out_flush();
+
+	longjmp(*en_jmp, status + 1);
+}
+
+/* Prefix with the label, if any, in one call so threads do not mix */
+static void en_vwarn(int errnum, const char *fmt, va_list ap)
+{
+	char msg[384];
+
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	if (errnum)
+		snprintf(en_errmsg, sizeof(en_errmsg), "%s: %s", msg, strerror(errnum));
+	else
+		snprintf(en_errmsg, sizeof(en_errmsg), "%s", msg);
+
+	if (en_label)
+		warnx("%s: %s", en_label, en_errmsg);
+	else
+		warnx("%s", en_errmsg);
+}
+
+/* The last error reported by this thread */
+const char *en_error(void)
+{
+	return en_errmsg;
+}
+
+void en_err(int status, const char *fmt, ...)
+{
+	int errnum = errno;
+	va_list ap;
+
+	va_start(ap, fmt);
+	en_vwarn(errnum, fmt, ap);
+	va_end(ap);
+
+	en_exit(status);
+}
+
+void en_errx(int status, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	en_vwarn(0, fmt, ap);
+	va_end(ap);
+
+	en_exit(status);
+}
+
+/*
+ * Run one command line through an already set up parser tree, used for
+ * the command line itself and for each command in batch, shell and server
+ * mode.  Returns the exit status of the command, errors do not terminate
+ * the process.
+ */
+int en_run(ArgParser *ap, int argc, char *argv[])
+{
+	jmp_buf jb, *prev = en_jmp;
+	bool json = sticky_json;
+	int rc, status = 0, depth = ap_parse_depth(ap);
+
+	iface_sync();
+	ap_reset(ap);
+	if (sticky_json)
+		ap_opt_set_flag(opt_json, true);
+
+	rc = setjmp(jb);
+	if (!rc) {
+		en_jmp = &jb;
+		/* Each @FILE stands for the arguments read from the file */
+		ap_parse_files(ap, argc, argv);
+		if (opts.batch) {
+			sticky_json = opts.json;
+			status = batch(ap, opts.batch);
+		} else if (opts.server)
+			status = server(ap);
+		else if (!ap_has_cmd(ap))
+			en_errx(1, "missing command");
+		rc = status;
+	} else {
+		ap_unwind(ap, depth);
+		rc--;
+	}
+
+	sticky_json = json;
+	en_jmp = prev;
+	out_flush();
+
+	return rc;
+}
+
+/*
+ * Run the callback of an already parsed command, used by the worker
+ * threads to run it in each network namespace.  Like en_run(), errors
+ * return the exit status, and the netlink socket is closed after.
+ */
+int en_run_cb(ArgParser *ap, void (*cb)(ArgParser *ap))
+{
+	jmp_buf jb, *prev = en_jmp;
+	int rc;
+
+	en_errmsg[0] = 0;
+	rc = setjmp(jb);
+	if (!rc) {
+		en_jmp = &jb;
+		cb(ap);
+	} else
+		rc--;
+	en_jmp = prev;
+
+	if (en_tx_flush())
+		rc = 1;
+	en_nl_close();
+	out_flush();
+
+	return rc;
+}
+
+/* Close this thread's netlink sockets, they are opened again on use */
+void en_nl_close(void)
+{
+	nl_close(rtnl);
+	rtnl = NULL;
+	nl_close(genl);
+	genl = NULL;
+}
+
+/* --json is a global option, the same for every command */
+bool en_json(void)
+{
+	return opts.json;
+}
+
+/* Make --json stick across all commands run by batch and shell mode */
+void en_set_json(bool json)
+{
+	sticky_json = json;
+}
+
+struct nl *en_rtnl(void)
+{
+	if (!rtnl) {
+		rtnl = nl_open(NETLINK_ROUTE);
+		if (!rtnl)
+			en_err(1, "Failed opening netlink socket");
+		nl_set_rcvbuf(rtnl, NL_RCVBUF);
+	}
+
+	return rtnl;
+}
+
+/* Generic netlink, e.g. for ethtool */
+struct nl *en_genl(void)
+{
+	if (!genl) {
+		genl = nl_open(NETLINK_GENERIC);
+		if (!genl)
+			en_err(1, "Failed opening netlink socket");
+	}
+
+	return genl;
+}
+
+/*
+ * Queue a change request in the write pipeline.  Failures are reported
+ * asynchronously, prefixed with the tag of the command that queued it.
+ */
+void en_tx(struct nlmsghdr *req)
+{
+	if (nl_tx(en_rtnl(), req, en_tag))
+		en_err(1, "Failed sending request");
+}
+
+/* Returns number of failed requests */
+int en_tx_flush(void)
+{
+	if (!rtnl)
+		return 0;
+
+	return nl_tx_flush(rtnl);
+}
+
+void en_set_tag(const char *tag)
+{
+	en_tag = tag;
+}
+
+/* Prefix for error messages, e.g. the network namespace */
+void en_set_label(const char *label)
+{
+	en_label = label;
+}
+
+/* Parse ADDR[/LEN] or "default", LEN defaults to a host prefix */
+void en_parse_prefix(const char *arg, struct prefix *pfx)
+{
+	char buf[INET6_ADDRSTRLEN + 5], *slash;
+	int max;
+
+	memset(pfx, 0, sizeof(*pfx));
+	if (!strcmp(arg, "default")) {
+		pfx->family = AF_INET;
+		return;
+	}
+
+	if (strlen(arg) >= sizeof(buf))
+		en_errx(1, "invalid prefix '%s'", arg);
+	strcpy(buf, arg);
+
+	slash = strchr(buf, '/');
+	if (slash)
+		*slash++ = 0;
+
+	if (inet_pton(AF_INET, buf, pfx->addr) == 1) {
+		pfx->family = AF_INET;
+		max = 32;
+	} else if (inet_pton(AF_INET6, buf, pfx->addr) == 1) {
+		pfx->family = AF_INET6;
+		max = 128;
+	} else
+		en_errx(1, "invalid prefix '%s'", arg);
+
+	pfx->len = max;
+	if (slash) {
+		char *end;
+
+		pfx->len = strtol(slash, &end, 10);
+		if (*slash == 0 || *end != 0 || pfx->len < 0 || pfx->len > max)
+			en_errx(1, "invalid prefix length in '%s'", arg);
+	}
+}
+
+static const char *operstate(struct rtattr *rta)
+{
+	unsigned char state;
+
+	if (!rta)
+		return "unknown";
+
+	state = *(unsigned char *)RTA_DATA(rta);
+	if (state >= NELEMS(operstates))
+		return "unknown";
+
+	return operstates[state];
+}
+
+static void ip_show_json(struct ifinfomsg *ifi, struct rtattr *tb[])
+{
+	struct rtnl_link_stats64 st;
+	size_t i;
+
+	json_begin_object(NULL);
+	json_uint("ifindex", ifi->ifi_index);
+	json_string("ifname", nl_attr_str(tb[IFLA_IFNAME]));
+
+	json_begin_array("flags");
+	for (i = 0; i < NELEMS(ifflags); i++) {
+		if (ifi->ifi_flags & ifflags[i].flag)
+			json_string(NULL, ifflags[i].name);
+	}
+	json_end_array();
+
+	if (tb[IFLA_MTU])
+		json_uint("mtu", nl_attr_u32(tb[IFLA_MTU]));
+	json_string("operstate", operstate(tb[IFLA_OPERSTATE]));
+
+	if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == 6)
+		json_mac("address", RTA_DATA(tb[IFLA_ADDRESS]));
+
+	if (tb[IFLA_STATS64]) {
+		memcpy(&st, RTA_DATA(tb[IFLA_STATS64]), sizeof(st));
+		json_begin_object("stats64");
+		json_begin_object("rx");
+		json_uint("bytes",   st.rx_bytes);
+		json_uint("packets", st.rx_packets);
+		json_uint("errors",  st.rx_errors);
+		json_uint("dropped", st.rx_dropped);
+		json_end_object();
+		json_begin_object("tx");
+		json_uint("bytes",   st.tx_bytes);
+		json_uint("packets", st.tx_packets);
+		json_uint("errors",  st.tx_errors);
+		json_uint("dropped", st.tx_dropped);
+		json_end_object();
+		json_end_object();
+	}
+
+	json_end_object();
+}
+
+static void ip_show_stats(const char *dir, uint64_t bytes, uint64_t packets,
+			  uint64_t errors, uint64_t dropped)
+{
+	out_str("    ");
+	out_str(dir);
+	out_str(": bytes ");
+	out_u64(bytes);
+	out_str(" packets ");
+	out_u64(packets);
+	out_str(" errors ");
+	out_u64(errors);
+	out_str(" dropped ");
+	out_u64(dropped);
+	out_char('\n');
+}
+
+static void ip_show_text(struct ifinfomsg *ifi, struct rtattr *tb[])
+{
+	struct rtnl_link_stats64 st;
+	int sep = '<';
+	size_t i;
+
+	out_u64(ifi->ifi_index);
+	out_str(": ");
+	out_str(nl_attr_str(tb[IFLA_IFNAME]));
+	out_str(": ");
+	for (i = 0; i < NELEMS(ifflags); i++) {
+		if (!(ifi->ifi_flags & ifflags[i].flag))
+			continue;
+		out_char(sep);
+		out_str(ifflags[i].name);
+		sep = ',';
+	}
+	if (sep == '<')
+		out_char(sep);
+	out_char('>');
+
+	if (tb[IFLA_MTU]) {
+		out_str(" mtu ");
+		out_u64(nl_attr_u32(tb[IFLA_MTU]));
+	}
+	out_str(" state ");
+	out_str(operstate(tb[IFLA_OPERSTATE]));
+	out_char('\n');
+
+	if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == 6) {
+		out_str(ifi->ifi_type == ARPHRD_LOOPBACK ? "    link/loopback " : "    link/ether ");
+		out_mac(RTA_DATA(tb[IFLA_ADDRESS]));
+		out_char('\n');
+	}
+
+	if (tb[IFLA_STATS64]) {
+		memcpy(&st, RTA_DATA(tb[IFLA_STATS64]), sizeof(st));
+		ip_show_stats("RX", st.rx_bytes, st.rx_packets, st.rx_errors, st.rx_dropped);
+		ip_show_stats("TX", st.tx_bytes, st.tx_packets, st.tx_errors, st.tx_dropped);
+	}
+}
+
+enum {
+	LF_IFINDEX, LF_NAME, LF_STATE, LF_MTU, LF_ADDRESS, LF_UP,
+	LF_RX_BYTES, LF_RX_PACKETS, LF_RX_ERRORS, LF_RX_DROPPED,
+	LF_TX_BYTES, LF_TX_PACKETS, LF_TX_ERRORS, LF_TX_DROPPED,
+};
+
+static const struct filter_field link_fields[] = {
+	{ "ifindex",    LF_IFINDEX,    FILTER_NUM },
+	{ "name",       LF_NAME,       FILTER_STR },
+	{ "ifname",     LF_NAME,       FILTER_STR },
+	{ "state",      LF_STATE,      FILTER_STR },
+	{ "mtu",        LF_MTU,        FILTER_NUM },
+	{ "address",    LF_ADDRESS,    FILTER_STR },
+	{ "up",         LF_UP,         FILTER_NUM },
+	{ "rx_bytes",   LF_RX_BYTES,   FILTER_NUM },
+	{ "rx_packets", LF_RX_PACKETS, FILTER_NUM },
+	{ "rx_errors",  LF_RX_ERRORS,  FILTER_NUM },
+	{ "rx_dropped", LF_RX_DROPPED, FILTER_NUM },
+	{ "tx_bytes",   LF_TX_BYTES,   FILTER_NUM },
+	{ "tx_packets", LF_TX_PACKETS, FILTER_NUM },
+	{ "tx_errors",  LF_TX_ERRORS,  FILTER_NUM },
+	{ "tx_dropped", LF_TX_DROPPED, FILTER_NUM },
+};
+
+struct link_show {
+	bool              json;
+	struct filter    *flt;
+
+	/* Record being filtered */
+	struct ifinfomsg *ifi;
+	struct rtattr   **tb;
+};
+
+static void link_field(void *rec, int id, struct filter_val *val)
+{
+	struct link_show *ls = rec;
+	struct rtattr **tb = ls->tb;
+	struct rtnl_link_stats64 st;
+
+	switch (id) {
+	case LF_IFINDEX:
+		val->num = ls->ifi->ifi_index;
+		return;
+	case LF_NAME:
+		val->str = nl_attr_str(tb[IFLA_IFNAME]);
+		return;
+	case LF_STATE:
+		val->str = operstate(tb[IFLA_OPERSTATE]);
+		return;
+	case LF_MTU:
+		if (tb[IFLA_MTU])
+			val->num = nl_attr_u32(tb[IFLA_MTU]);
+		return;
+	case LF_ADDRESS:
+		if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == 6)
+			val->str = out_fmt_mac(val->buf, RTA_DATA(tb[IFLA_ADDRESS]));
+		return;
+	case LF_UP:
+		val->num = !!(ls->ifi->ifi_flags & IFF_UP);
+		return;
+	}
+
+	if (!tb[IFLA_STATS64])
+		return;
+
+	memcpy(&st, RTA_DATA(tb[IFLA_STATS64]), sizeof(st));
+	switch (id) {
+	case LF_RX_BYTES:   val->num = st.rx_bytes;   break;
+	case LF_RX_PACKETS: val->num = st.rx_packets; break;
+	case LF_RX_ERRORS:  val->num = st.rx_errors;  break;
+	case LF_RX_DROPPED: val->num = st.rx_dropped; break;
+	case LF_TX_BYTES:   val->num = st.tx_bytes;   break;
+	case LF_TX_PACKETS: val->num = st.tx_packets; break;
+	case LF_TX_ERRORS:  val->num = st.tx_errors;  break;
+	case LF_TX_DROPPED: val->num = st.tx_dropped; break;
+	}
+}
+
+static int ip_show_link(struct nlmsghdr *nlh, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct link_show *ls = arg;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return 0;
+
+	nl_attr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+	if (!tb[IFLA_IFNAME])
+		return 0;
+
+	ls->ifi = ifi;
+	ls->tb = tb;
+	if (!filter_match(ls->flt, link_field, ls))
+		return 0;
+
+	if (ls->json)
+		ip_show_json(ifi, tb);
+	else
+		ip_show_text(ifi, tb);
+
+	return 0;
+}
 
 void ip_show(ArgParser *ap)
 {
-	char cmd[256] = "ifconfig";
+	struct {
+		struct nlmsghdr  nh;
+		struct ifinfomsg ifi;
+		char             attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.nh.nlmsg_type  = RTM_GETLINK,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.ifi.ifi_family = AF_UNSPEC,
+	};
+	struct link_show ls = {
+		.json = en_json(),
+		.flt  = en_filter(link_fields, NELEMS(link_fields)),
+	};
+	char *ifname = NULL;
 
-	if (ap_has_args(ap))
-		snprintf(cmd, sizeof(cmd), "ifconfig %s", ap_get_arg(ap, 0));
+	if (ap_has_args(ap)) {
+		ifname = ap_get_arg(ap, 0);
+		if (strlen(ifname) >= IFNAMSIZ)
+			en_errx(1, "%s: invalid interface name", ifname);
 
-	system(cmd);
+		req.nh.nlmsg_flags = NLM_F_REQUEST;
+		nl_attr_put_str(&req.nh, sizeof(req), IFLA_IFNAME, ifname);
+	}
+
+	if (ls.json)
+		json_begin_array(NULL);
+	if (nl_query(en_rtnl(), &req.nh, ip_show_link, &ls))
+		en_err(1, "%s", ifname ? ifname : "Failed reading links");
+	if (ls.json)
+		json_end_array();
 }
 
 int ip_init(ArgParser *ap)
 {
 	ArgParser *ip;
 
-	ip = ap_add_cmd(ap, "show", "Command!", ip_show);
+	ip = ap_add_cmd(ap, "show", "Show interfaces: [IFNAME]", ip_show);
 	if (!ip)
 		return 1;
+	filter_cmd(ip);
 
 	return 0;
 }
@@ -28,18 +588,55 @@ int ip_init(ArgParser *ap)
 int main(int argc, char *argv[])
 {
 	ArgParser *ap;
+	int rc;
+
+	/* Hand over to a running server, if there is one */
+	rc = client(argc, argv);
+	if (rc >= 0)
+		return rc;
 
 	ap = ap_new("Help!", "Version!");
 	if (!ap)
 		err(1, "Someone set up us the bomb");
 
+	opt_json = ap_bind_flag(ap, "json j", &opts.json);
+	ap_bind_str(ap, "batch b", &opts.batch);
+	ap_bind_flag(ap, "server", &opts.server);
+	ap_set_exit_cb(en_exit);
+	atexit(out_flush);
+
+	/* Command modules register their subcommands lazily, on first use */
 	if (ip_init(ap))
 		err(1, "Failed ip init");
+	if (addr_init(ap))
+		err(1, "Failed addr init");
+	if (fdb_init(ap))
+		err(1, "Failed fdb init");
+	if (filter_init(ap))
+		err(1, "Failed filter init");
+	if (link_init(ap))
+		err(1, "Failed link init");
+	if (neigh_init(ap))
+		err(1, "Failed neigh init");
+	if (netns_init(ap))
+		err(1, "Failed netns init");
+	if (port_init(ap))
+		err(1, "Failed port init");
+	if (route_init(ap))
+		err(1, "Failed route init");
+	if (shell_init(ap))
+		err(1, "Failed shell init");
+	if (vlan_init(ap))
+		err(1, "Failed vlan init");
+	if (plugin_init(ap))
+		err(1, "Failed plugin init");
 
-	ap_parse(ap, argc, argv);
-	if (!ap_has_cmd(ap))
-		errx(1, "Missing cmd");
+	rc = en_run(ap, argc, argv);
+	if (en_tx_flush())
+		rc = 1;
 	ap_free(ap);
+	nl_close(rtnl);
+	nl_close(genl);
 
-	return 0;
+	return rc;
 }
@@ -0,0 +1,81 @@
+#ifndef EN_H_
+#define EN_H_
+
+#include <stdbool.h>
+#include <net/if.h>
+
+#include "clio.h"
+#include "json.h"
+#include "nl.h"
+
+#define NELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+struct iface {
+	int           ifindex;
+	int           master;
+	unsigned int  flags;
+	unsigned int  mtu;
+	unsigned short type;
+	char          name[IF_NAMESIZE];
+};
+
+struct prefix {
+	int           family;
+	int           len;
+	unsigned char addr[16];
+};
+
+void        en_exit(int status) __attribute__((noreturn));
+void        en_err (int status, const char *fmt, ...) __attribute__((noreturn, format(printf, 2, 3)));
+void        en_errx(int status, const char *fmt, ...) __attribute__((noreturn, format(printf, 2, 3)));
+const char *en_error(void);
+
+int         en_run (ArgParser *ap, int argc, char *argv[]);
+int         en_run_cb(ArgParser *ap, void (*cb)(ArgParser *ap));
+int         batch  (ArgParser *ap, const char *file);
+bool        batch_active(void);
+
+#define EN_SOCKET	"/run/en.sock"
+#define EN_LOCAL	255	/* Server status: run in the client instead */
+#define EN_PLUGIN_DIR	"/usr/lib/en"	/* Unless $EN_PLUGIN_DIR is set */
+
+int         client (int argc, char *argv[]);
+int         server (ArgParser *ap);
+bool        server_active(void);
+bool        netns_worker(void);
+
+bool        en_json(void);
+void        en_set_json(bool json);
+struct nl  *en_rtnl(void);
+struct nl  *en_genl(void);
+void        en_nl_close(void);
+
+void        en_tx(struct nlmsghdr *req);
+int         en_tx_flush(void);
+void        en_set_tag(const char *tag);
+void        en_set_label(const char *label);
+
+const char *en_ifname(int ifindex);
+int         en_ifindex(const char *ifname);
+
+const struct iface *iface_get(int ifindex);
+const struct iface *iface_next(int ifindex);
+void        iface_monitor(void);
+void        iface_sync(void);
+void        iface_flush(void);
+void        iface_detach(void);
+
+void        en_parse_prefix(const char *arg, struct prefix *pfx);
+
+int addr_init (ArgParser *ap);
+int fdb_init  (ArgParser *ap);
+int link_init (ArgParser *ap);
+int neigh_init(ArgParser *ap);
+int netns_init(ArgParser *ap);
+int plugin_init(ArgParser *ap);
+int port_init (ArgParser *ap);
+int route_init(ArgParser *ap);
+int shell_init(ArgParser *ap);
+int vlan_init (ArgParser *ap);
+
+#endif /* EN_H_ */
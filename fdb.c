@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/if_bridge.h>
+#include <linux/neighbour.h>
+
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+
+#define VLAN_N_VID	4096
+#define FDB_USED	(1ULL << 63)
+
+enum {
+	COUNT_NONE,
+	COUNT_PORT,
+	COUNT_VLAN,
+};
+
+/* Choices for --count-by, indexed by the above */
+static const char *const count_names[] = {
+	[COUNT_NONE] = "none",
+	[COUNT_PORT] = "port",
+	[COUNT_VLAN] = "vlan",
+	NULL
+};
+
+/* MAC+VID, plus the port when counting by port */
+struct fdb_ent {
+	uint64_t key;
+	int      ifindex;
+};
+
+/* Set of entries, open addressing with linear probing */
+struct fdb_set {
+	struct fdb_ent *ents;
+	size_t          len;
+	size_t          size;	/* Power of two */
+};
+
+struct fdb_filter {
+	bool            json;
+	int             vid;
+	int             count_by;
+
+	struct filter  *flt;
+
+	struct fdb_set  set;
+	unsigned int   *counts;
+	size_t          ncounts;
+
+	/* Entry being filtered */
+	struct ndmsg   *ndm;
+	struct rtattr **tb;
+};
+
+enum {
+	FF_MAC, FF_DEV, FF_VLAN, FF_MASTER, FF_SELF, FF_STATE,
+};
+
+static const struct filter_field fdb_fields[] = {
+	{ "mac",    FF_MAC,    FILTER_STR },
+	{ "dev",    FF_DEV,    FILTER_STR },
+	{ "vlan",   FF_VLAN,   FILTER_NUM },
+	{ "master", FF_MASTER, FILTER_STR },
+	{ "self",   FF_SELF,   FILTER_NUM },
+	{ "state",  FF_STATE,  FILTER_STR },
+};
+
+static uint64_t fdb_key(const unsigned char *mac, uint16_t vid)
+{
+	uint64_t key = FDB_USED | vid;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		key |= (uint64_t)mac[i] << (16 + 8 * (5 - i));
+
+	return key;
+}
+
+static size_t fdb_hash(const struct fdb_ent *ent, size_t size)
+{
+	uint64_t key = ent->key ^ ((uint64_t)ent->ifindex << 32);
+
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+
+	return key & (size - 1);
+}
+
+/*
+ * Allocation failures are returned, not raised with en_err(), they happen
+ * in the middle of a dump and the caller has to free the set and counters.
+ */
+static int fdb_set_grow(struct fdb_set *set)
+{
+	struct fdb_ent *ents = set->ents;
+	size_t i, size = set->size;
+
+	set->size = size ? size * 2 : 1024;
+	set->ents = calloc(set->size, sizeof(*ents));
+	if (!set->ents) {
+		set->ents = ents;
+		set->size = size;
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) {
+		size_t pos;
+
+		if (!ents[i].key)
+			continue;
+
+		pos = fdb_hash(&ents[i], set->size);
+		while (set->ents[pos].key)
+			pos = (pos + 1) & (set->size - 1);
+		set->ents[pos] = ents[i];
+	}
+	free(ents);
+
+	return 0;
+}
+
+/* Returns 1 if @key on @ifindex was not already in the set, -1 on error */
+static int fdb_set_add(struct fdb_set *set, uint64_t key, int ifindex)
+{
+	struct fdb_ent ent = { key, ifindex };
+	size_t pos;
+
+	if (2 * (set->len + 1) > set->size && fdb_set_grow(set))
+		return -1;
+
+	pos = fdb_hash(&ent, set->size);
+	while (set->ents[pos].key) {
+		if (set->ents[pos].key == key && set->ents[pos].ifindex == ifindex)
+			return 0;
+		pos = (pos + 1) & (set->size - 1);
+	}
+
+	set->ents[pos] = ent;
+	set->len++;
+
+	return 1;
+}
+
+static int fdb_count(struct fdb_filter *f, size_t idx)
+{
+	if (idx >= f->ncounts) {
+		size_t num = f->ncounts ? f->ncounts : 64;
+		unsigned int *counts;
+
+		while (num <= idx)
+			num *= 2;
+
+		counts = realloc(f->counts, num * sizeof(*counts));
+		if (!counts)
+			return -1;
+		memset(&counts[f->ncounts], 0, (num - f->ncounts) * sizeof(*counts));
+
+		f->counts = counts;
+		f->ncounts = num;
+	}
+
+	f->counts[idx]++;
+
+	return 0;
+}
+
+static void fdb_show_counts(struct fdb_filter *f)
+{
+	size_t i;
+
+	for (i = 0; i < f->ncounts; i++) {
+		if (!f->counts[i])
+			continue;
+
+		if (f->json) {
+			json_begin_object(NULL);
+			if (f->count_by == COUNT_PORT)
+				json_string("port", en_ifname(i));
+			else
+				json_uint("vlan", i);
+			json_uint("count", f->counts[i]);
+			json_end_object();
+			continue;
+		}
+
+		if (f->count_by == COUNT_PORT)
+			out_str(en_ifname(i));
+		else
+			out_u64(i);
+		out_char(' ');
+		out_u64(f->counts[i]);
+		out_char('\n');
+	}
+}
+
+static void fdb_field(void *rec, int id, struct filter_val *val)
+{
+	struct fdb_filter *f = rec;
+	struct ndmsg *ndm = f->ndm;
+	struct rtattr **tb = f->tb;
+
+	switch (id) {
+	case FF_MAC:
+		val->str = out_fmt_mac(val->buf, RTA_DATA(tb[NDA_LLADDR]));
+		break;
+	case FF_DEV:
+		val->str = en_ifname(ndm->ndm_ifindex);
+		break;
+	case FF_VLAN:
+		if (tb[NDA_VLAN])
+			val->num = *(uint16_t *)RTA_DATA(tb[NDA_VLAN]);
+		break;
+	case FF_MASTER:
+		if (tb[NDA_MASTER])
+			val->str = en_ifname(nl_attr_u32(tb[NDA_MASTER]));
+		break;
+	case FF_SELF:
+		val->num = !!(ndm->ndm_flags & NTF_SELF);
+		break;
+	case FF_STATE:
+		if (ndm->ndm_state & NUD_PERMANENT)
+			val->str = "permanent";
+		else if (ndm->ndm_state & NUD_NOARP)
+			val->str = "static";
+		break;
+	}
+}
+
+static void fdb_show_json(struct ndmsg *ndm, struct rtattr *tb[])
+{
+	json_begin_object(NULL);
+	json_mac("mac", RTA_DATA(tb[NDA_LLADDR]));
+	json_string("dev", en_ifname(ndm->ndm_ifindex));
+	if (tb[NDA_VLAN])
+		json_uint("vlan", *(uint16_t *)RTA_DATA(tb[NDA_VLAN]));
+	if (tb[NDA_MASTER])
+		json_string("master", en_ifname(nl_attr_u32(tb[NDA_MASTER])));
+	if (ndm->ndm_flags & NTF_SELF)
+		json_bool("self", true);
+	if (ndm->ndm_flags & NTF_EXT_LEARNED)
+		json_bool("extern_learn", true);
+	if (ndm->ndm_flags & NTF_OFFLOADED)
+		json_bool("offload", true);
+	if (ndm->ndm_state & NUD_PERMANENT)
+		json_string("state", "permanent");
+	else if (ndm->ndm_state & NUD_NOARP)
+		json_string("state", "static");
+	json_end_object();
+}
+
+static void fdb_show_text(struct ndmsg *ndm, struct rtattr *tb[])
+{
+	out_mac(RTA_DATA(tb[NDA_LLADDR]));
+	out_str(" dev ");
+	out_str(en_ifname(ndm->ndm_ifindex));
+	if (tb[NDA_VLAN]) {
+		out_str(" vlan ");
+		out_u64(*(uint16_t *)RTA_DATA(tb[NDA_VLAN]));
+	}
+	if (tb[NDA_MASTER]) {
+		out_str(" master ");
+		out_str(en_ifname(nl_attr_u32(tb[NDA_MASTER])));
+	}
+	if (ndm->ndm_flags & NTF_SELF)
+		out_str(" self");
+	if (ndm->ndm_flags & NTF_EXT_LEARNED)
+		out_str(" extern_learn");
+	if (ndm->ndm_flags & NTF_OFFLOADED)
+		out_str(" offload");
+	if (ndm->ndm_state & NUD_PERMANENT)
+		out_str(" permanent");
+	else if (ndm->ndm_state & NUD_NOARP)
+		out_str(" static");
+	out_char('\n');
+}
+
+static int fdb_show_one(struct nlmsghdr *nlh, void *arg)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct fdb_filter *f = arg;
+	struct rtattr *tb[NDA_MAX + 1];
+	uint16_t vid = 0;
+	int rc = 0;
+
+	if (nlh->nlmsg_type != RTM_NEWNEIGH || ndm->ndm_family != AF_BRIDGE)
+		return 0;
+
+	nl_attr_parse(tb, NDA_MAX, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+	if (!tb[NDA_LLADDR] || RTA_PAYLOAD(tb[NDA_LLADDR]) != 6)
+		return 0;
+
+	if (tb[NDA_VLAN])
+		vid = *(uint16_t *)RTA_DATA(tb[NDA_VLAN]) % VLAN_N_VID;
+	if (f->vid >= 0 && vid != f->vid)
+		return 0;
+
+	f->ndm = ndm;
+	f->tb = tb;
+	if (!filter_match(f->flt, fdb_field, f))
+		return 0;
+
+	/*
+	 * An address is counted once per port, the same MAC+VID can be on
+	 * several ports, e.g. per-port self entries for multicast, and once
+	 * per VLAN however many ports it is on.
+	 */
+	switch (f->count_by) {
+	case COUNT_PORT:
+		rc = fdb_set_add(&f->set, fdb_key(RTA_DATA(tb[NDA_LLADDR]), vid), ndm->ndm_ifindex);
+		if (rc > 0)
+			rc = fdb_count(f, ndm->ndm_ifindex);
+		break;
+
+	case COUNT_VLAN:
+		rc = fdb_set_add(&f->set, fdb_key(RTA_DATA(tb[NDA_LLADDR]), vid), 0);
+		if (rc > 0)
+			rc = fdb_count(f, vid);
+		break;
+
+	default:
+		if (f->json)
+			fdb_show_json(ndm, tb);
+		else
+			fdb_show_text(ndm, tb);
+		break;
+	}
+
+	return rc < 0 ? -1 : 0;
+}
+
+static ApOpt *opt_count_by;
+
+static void fdb_show(ArgParser *ap)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ndmsg    ndm;
+		char            attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.nh.nlmsg_type  = RTM_GETNEIGH,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.ndm.ndm_family = AF_BRIDGE,
+	};
+	struct fdb_filter f = {
+		.json     = en_json(),
+		.vid      = -1,
+		.count_by = ap_opt_get_int(opt_count_by),
+		.flt      = en_filter(fdb_fields, NELEMS(fdb_fields)),
+	};
+	int i, rc, argc = ap_len_args(ap);
+
+	for (i = 0; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+		char *end;
+
+		if (++i >= argc)
+			en_errx(1, "missing argument to '%s'", arg);
+
+		if (!strcmp(arg, "bridge") || !strcmp(arg, "br"))
+			nl_attr_put_u32(&req.nh, sizeof(req), NDA_MASTER, en_ifindex(ap_get_arg(ap, i)));
+		else if (!strcmp(arg, "port") || !strcmp(arg, "dev"))
+			req.ndm.ndm_ifindex = en_ifindex(ap_get_arg(ap, i));
+		else if (!strcmp(arg, "vlan")) {
+			f.vid = strtol(ap_get_arg(ap, i), &end, 10);
+			if (*end || f.vid < 0 || f.vid >= VLAN_N_VID)
+				en_errx(1, "invalid vlan '%s'", ap_get_arg(ap, i));
+		} else
+			en_errx(1, "unknown argument '%s'", arg);
+	}
+
+	if (f.json)
+		json_begin_array(NULL);
+	rc = nl_query(en_rtnl(), &req.nh, fdb_show_one, &f);
+	if (!rc && f.count_by != COUNT_NONE)
+		fdb_show_counts(&f);
+
+	free(f.set.ents);
+	free(f.counts);
+
+	if (rc)
+		en_err(1, "Failed reading FDB");
+	if (f.json)
+		json_end_array();
+}
+
+static void fdb_cmds(ArgParser *fdb)
+{
+	ArgParser *show;
+
+	show = ap_add_cmd(fdb, "show list", "Show FDB: [bridge BR] [vlan VID] [port IFNAME] [--count-by none|port|vlan], distinct MAC+VID per port or per VLAN", fdb_show);
+	opt_count_by = ap_add_choice(show, "count-by", count_names, COUNT_NONE);
+	filter_cmd(show);
+}
+
+int fdb_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "fdb", "Bridge forwarding database management", fdb_cmds, NULL);
+
+	return 0;
+}
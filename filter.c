@@ -0,0 +1,489 @@
+#include <ctype.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "en.h"
+#include "filter.h"
+
+#define FILTER_DEPTH	32		/* Max nesting of ( and ! */
+
+enum {
+	T_END, T_IDENT, T_EQ, T_NE, T_LT, T_LE, T_GT, T_GE, T_RE, T_NRE,
+	T_AND, T_OR, T_NOT, T_LPAREN, T_RPAREN,
+};
+
+/* Operators, longest first */
+static const struct {
+	const char *str;
+	int         tok;
+} ops[] = {
+	{ "==", T_EQ  }, { "!=", T_NE  }, { "<=", T_LE     }, { ">=", T_GE     },
+	{ "!~", T_NRE }, { "&&", T_AND }, { "||", T_OR     }, { "<",  T_LT     },
+	{ ">",  T_GT  }, { "~",  T_RE  }, { "!",  T_NOT    }, { "(",  T_LPAREN },
+	{ ")",  T_RPAREN },
+};
+
+enum {
+	OP_NUM,			/* Compare number field */
+	OP_STR,			/* Compare string field */
+	OP_RE,			/* Match string field */
+	OP_AND,			/* Result false, skip to jmp */
+	OP_OR,			/* Result true, skip to jmp */
+	OP_NOT,
+};
+
+/*
+ * The program is a flat list of tests and short-circuit jumps.  Every
+ * test overwrites the result and a jump only looks at it, so evaluation
+ * needs no stack, only a single bool.
+ */
+struct insn {
+	unsigned char  op;
+	unsigned char  cmp;		/* T_EQ .. T_NRE */
+	int            field;
+	size_t         jmp;
+	union {
+		double     num;
+		char      *str;
+		regex_t   *re;
+	};
+};
+
+struct filter {
+	char                      *expr;	/* NULL until compiled */
+	const struct filter_field *fields;
+
+	struct insn               *code;
+	size_t                     len;
+	size_t                     max;
+};
+
+struct parser {
+	struct filter             *flt;
+	const struct filter_field *fields;
+	size_t                     num;
+
+	const char                *expr;
+	const char                *pos;	/* After the current token */
+	const char                *start;	/* Of the current token */
+	int                        tok;
+	int                        depth;
+};
+
+/* Last compiled filter, reused as long as the same one is asked for */
+static __thread struct filter *cached;
+static ApOpt                  *opt_filter;
+
+/* Commands that apply --filter, the option is global but they are not */
+static ArgParser             **cmds;
+static size_t                  ncmds;
+
+static void filter_free(struct filter *flt)
+{
+	size_t i;
+
+	if (!flt)
+		return;
+
+	for (i = 0; i < flt->len; i++) {
+		struct insn *in = &flt->code[i];
+
+		if (in->op == OP_STR)
+			free(in->str);
+		else if (in->op == OP_RE && in->re) {
+			regfree(in->re);
+			free(in->re);
+		}
+	}
+	free(flt->code);
+	free(flt->expr);
+	free(flt);
+}
+
+static void __attribute__((noreturn)) syntax(struct parser *p, const char *msg)
+{
+	en_errx(1, "filter: %s at column %d", msg, (int)(p->start - p->expr) + 1);
+}
+
+static void next(struct parser *p)
+{
+	size_t i;
+
+	while (isspace((unsigned char)*p->pos))
+		p->pos++;
+	p->start = p->pos;
+
+	if (!*p->pos) {
+		p->tok = T_END;
+		return;
+	}
+
+	if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+		while (isalnum((unsigned char)*p->pos) || *p->pos == '_')
+			p->pos++;
+		p->tok = T_IDENT;
+		return;
+	}
+
+	for (i = 0; i < NELEMS(ops); i++) {
+		size_t len = strlen(ops[i].str);
+
+		if (!strncmp(p->pos, ops[i].str, len)) {
+			p->pos += len;
+			p->tok = ops[i].tok;
+			return;
+		}
+	}
+
+	syntax(p, "unexpected character");
+}
+
+static struct insn *emit(struct parser *p, int op)
+{
+	struct filter *flt = p->flt;
+	struct insn *in;
+
+	if (flt->len == flt->max) {
+		size_t max = flt->max ? flt->max * 2 : 16;
+
+		in = realloc(flt->code, max * sizeof(*in));
+		if (!in)
+			en_err(1, "Failed allocating filter");
+		flt->code = in;
+		flt->max = max;
+	}
+
+	in = &flt->code[flt->len++];
+	memset(in, 0, sizeof(*in));
+	in->op = op;
+
+	return in;
+}
+
+static const struct filter_field *field(struct parser *p)
+{
+	size_t i, len = p->pos - p->start;
+
+	for (i = 0; i < p->num; i++) {
+		if (strlen(p->fields[i].name) == len && !strncmp(p->fields[i].name, p->start, len))
+			return &p->fields[i];
+	}
+
+	syntax(p, "unknown field");
+}
+
+/*
+ * "quoted", where only \" and \\ are escapes so regular expressions keep
+ * theirs, or a bare word up to the next operator
+ */
+static char *string(struct parser *p)
+{
+	const char *pos = p->pos;
+	char *str, *dst;
+
+	while (isspace((unsigned char)*pos))
+		pos++;
+	p->start = pos;
+
+	str = dst = malloc(strlen(pos) + 1);
+	if (!str)
+		en_err(1, "Failed allocating filter");
+
+	if (*pos == '"') {
+		for (pos++; *pos && *pos != '"'; pos++) {
+			if (*pos == '\\' && (pos[1] == '"' || pos[1] == '\\'))
+				pos++;
+			*dst++ = *pos;
+		}
+		if (!*pos) {
+			free(str);
+			syntax(p, "unterminated string");
+		}
+		pos++;
+	} else {
+		while (*pos && !isspace((unsigned char)*pos) && !strchr("()&|!=<>~\"", *pos))
+			*dst++ = *pos++;
+		if (dst == str) {
+			free(str);
+			syntax(p, "missing value");
+		}
+	}
+	*dst = 0;
+	p->pos = pos;
+
+	return str;
+}
+
+static double number(struct parser *p)
+{
+	char *end;
+	double num;
+
+	while (isspace((unsigned char)*p->pos))
+		p->pos++;
+	p->start = p->pos;
+
+	num = strtod(p->pos, &end);
+	if (end == p->pos)
+		syntax(p, "expected number");
+	p->pos = end;
+
+	return num;
+}
+
+/* FIELD [OP VALUE], a field on its own is true if non-zero or non-empty */
+static void test(struct parser *p)
+{
+	const struct filter_field *f = field(p);
+	struct insn *in;
+	int cmp;
+
+	next(p);
+	cmp = p->tok;
+	if (cmp < T_EQ || cmp > T_NRE) {
+		in = emit(p, f->type == FILTER_NUM ? OP_NUM : OP_STR);
+		in->field = f->id;
+		in->cmp = T_NE;
+		if (f->type == FILTER_STR && !(in->str = strdup("")))
+			en_err(1, "Failed allocating filter");
+		return;
+	}
+
+	if (f->type == FILTER_NUM) {
+		if (cmp == T_RE || cmp == T_NRE)
+			syntax(p, "cannot match a number");
+		in = emit(p, OP_NUM);
+		in->field = f->id;
+		in->cmp = cmp;
+		in->num = number(p);
+	} else if (cmp == T_RE || cmp == T_NRE) {
+		char *re = string(p);
+
+		in = emit(p, OP_RE);
+		in->field = f->id;
+		in->cmp = cmp;
+		in->re = malloc(sizeof(regex_t));
+		if (!in->re) {
+			free(re);
+			en_err(1, "Failed allocating filter");
+		}
+		if (regcomp(in->re, re, REG_EXTENDED | REG_NOSUB)) {
+			free(in->re);
+			in->re = NULL;
+			free(re);
+			syntax(p, "invalid regular expression");
+		}
+		free(re);
+	} else {
+		in = emit(p, OP_STR);
+		in->field = f->id;
+		in->cmp = cmp;
+		in->str = string(p);
+	}
+
+	next(p);
+}
+
+static void expr(struct parser *p);
+
+static void unary(struct parser *p)
+{
+	if (++p->depth > FILTER_DEPTH)
+		syntax(p, "too deeply nested");
+
+	switch (p->tok) {
+	case T_NOT:
+		next(p);
+		unary(p);
+		emit(p, OP_NOT);
+		break;
+
+	case T_LPAREN:
+		next(p);
+		expr(p);
+		if (p->tok != T_RPAREN)
+			syntax(p, "missing ')'");
+		next(p);
+		break;
+
+	case T_IDENT:
+		test(p);
+		break;
+
+	default:
+		syntax(p, "expected field");
+	}
+
+	p->depth--;
+}
+
+static void and(struct parser *p)
+{
+	unary(p);
+	while (p->tok == T_AND) {
+		size_t jmp = p->flt->len;
+
+		emit(p, OP_AND);
+		next(p);
+		unary(p);
+		p->flt->code[jmp].jmp = p->flt->len;
+	}
+}
+
+static void expr(struct parser *p)
+{
+	and(p);
+	while (p->tok == T_OR) {
+		size_t jmp = p->flt->len;
+
+		emit(p, OP_OR);
+		next(p);
+		and(p);
+		p->flt->code[jmp].jmp = p->flt->len;
+	}
+}
+
+/*
+ * The --filter expression for a show command with these @fields, or NULL
+ * if there is none.  Compiled on first use, batch and shell mode running
+ * the same command again get the same program back.
+ */
+struct filter *en_filter(const struct filter_field *fields, size_t num)
+{
+	struct parser p = {
+		.fields = fields,
+		.num    = num,
+	};
+	const char *str;
+
+	str = ap_opt_get_str(opt_filter);
+	if (!str)
+		return NULL;
+
+	if (cached && cached->expr && cached->fields == fields && !strcmp(cached->expr, str))
+		return cached;
+
+	/* Keep what we build in the cache, on error it is freed next time */
+	filter_free(cached);
+	cached = calloc(1, sizeof(*cached));
+	if (!cached)
+		en_err(1, "Failed allocating filter");
+
+	p.flt = cached;
+	p.expr = p.pos = str;
+	next(&p);
+	expr(&p);
+	if (p.tok != T_END)
+		syntax(&p, "unexpected input");
+
+	cached->fields = fields;
+	cached->expr = strdup(str);
+	if (!cached->expr)
+		en_err(1, "Failed allocating filter");
+
+	return cached;
+}
+
+static bool compare(int cmp, int diff)
+{
+	switch (cmp) {
+	case T_EQ: return diff == 0;
+	case T_NE: return diff != 0;
+	case T_LT: return diff < 0;
+	case T_LE: return diff <= 0;
+	case T_GT: return diff > 0;
+	case T_GE: return diff >= 0;
+	}
+
+	return false;
+}
+
+bool filter_match(const struct filter *flt, filter_get_t get, void *rec)
+{
+	struct filter_val val;
+	bool result = true;
+	size_t pc = 0;
+
+	if (!flt)
+		return true;
+
+	while (pc < flt->len) {
+		const struct insn *in = &flt->code[pc++];
+
+		switch (in->op) {
+		case OP_AND:
+			if (!result)
+				pc = in->jmp;
+			continue;
+		case OP_OR:
+			if (result)
+				pc = in->jmp;
+			continue;
+		case OP_NOT:
+			result = !result;
+			continue;
+		}
+
+		val.num = 0;
+		val.str = "";
+		get(rec, in->field, &val);
+		if (!val.str)
+			val.str = "";
+
+		switch (in->op) {
+		case OP_NUM:
+			result = compare(in->cmp, (val.num > in->num) - (val.num < in->num));
+			break;
+		case OP_STR:
+			result = compare(in->cmp, strcmp(val.str, in->str));
+			break;
+		case OP_RE:
+			result = !regexec(in->re, val.str, 0, NULL, 0) == (in->cmp == T_RE);
+			break;
+		}
+	}
+
+	return result;
+}
+
+/* Free this thread's compiled filter, done by each namespace worker */
+void filter_release(void)
+{
+	filter_free(cached);
+	cached = NULL;
+}
+
+void filter_cmd(ArgParser *cmd)
+{
+	ArgParser **tmp;
+
+	tmp = realloc(cmds, (ncmds + 1) * sizeof(*cmds));
+	if (!tmp)
+		en_err(1, "Failed allocating filter");
+	cmds = tmp;
+	cmds[ncmds++] = cmd;
+}
+
+/* Called before @cmd runs, so a --filter it would ignore is an error */
+void filter_check(ArgParser *cmd)
+{
+	size_t i;
+
+	if (!ap_opt_get_str(opt_filter))
+		return;
+
+	for (i = 0; i < ncmds; i++) {
+		if (cmds[i] == cmd)
+			return;
+	}
+
+	en_errx(1, "--filter is not supported by this command");
+}
+
+int filter_init(ArgParser *ap)
+{
+	opt_filter = ap_add_str(ap, "filter", NULL);
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef EN_FILTER_H_
+#define EN_FILTER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "clio.h"
+
+/*
+ * Filter expressions for show commands, --filter 'state==up && mtu>1500'.
+ * Each command lists the fields it knows, the expression is compiled
+ * against them once and then run on every record before it is formatted.
+ * Commands register with filter_cmd(), all others reject --filter.
+ */
+enum {
+	FILTER_NUM,
+	FILTER_STR,
+};
+
+struct filter_field {
+	const char *name;
+	int         id;		/* Passed to the getter */
+	int         type;	/* FILTER_NUM or FILTER_STR */
+};
+
+/* A missing field is 0 or "" */
+struct filter_val {
+	double      num;
+	const char *str;
+	char        buf[64];	/* Scratch space for the getter */
+};
+
+typedef void (*filter_get_t)(void *rec, int id, struct filter_val *val);
+
+struct filter;
+
+int            filter_init(ArgParser *ap);
+void           filter_release(void);
+void           filter_cmd(ArgParser *cmd);
+void           filter_check(ArgParser *cmd);
+struct filter *en_filter(const struct filter_field *fields, size_t num);
+bool           filter_match(const struct filter *flt, filter_get_t get, void *rec);
+
+#endif /* EN_FILTER_H_ */
@@ -0,0 +1,290 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "en.h"
+
+/*
+ * Interface cache, a flat array indexed by ifindex and a name hash with
+ * open addressing, holding ifindex.  Filled by one link dump on first
+ * use.  In shell and server mode we also listen to RTNLGRP_LINK and apply
+ * changes before each command, so a lookup never has to ask the kernel.
+ * Each thread has its own cache, for the namespace it is working in, and
+ * only the thread that called iface_monitor() follows changes.
+ */
+static __thread struct iface *ifaces;
+static __thread int           nifaces;	/* Size of ifaces[] */
+
+static __thread int          *names;
+static __thread size_t        nnames;	/* Power of two */
+static __thread size_t        nused;
+
+static __thread struct nl    *iface_nl;	/* Dumps, separate from en_rtnl() */
+static __thread struct nl    *iface_mon;	/* Change notifications */
+static __thread bool          loaded;
+
+static size_t name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash & (nnames - 1);
+}
+
+static void name_insert(int ifindex)
+{
+	size_t pos = name_hash(ifaces[ifindex].name);
+
+	while (names[pos])
+		pos = (pos + 1) & (nnames - 1);
+	names[pos] = ifindex;
+	nused++;
+}
+
+/* Deletes and renames are rare, rebuild the hash then */
+static void name_rehash(size_t min)
+{
+	int i;
+
+	if (nnames < 2 * min) {
+		size_t size = nnames ? nnames : 64;
+
+		while (size < 2 * min)
+			size *= 2;
+		free(names);
+		names = malloc(size * sizeof(int));
+		if (!names)
+			en_err(1, "Failed allocating interface cache");
+		nnames = size;
+	}
+
+	memset(names, 0, nnames * sizeof(int));
+	nused = 0;
+	for (i = 1; i < nifaces; i++) {
+		if (ifaces[i].ifindex)
+			name_insert(i);
+	}
+}
+
+static void iface_del(int ifindex)
+{
+	if (ifindex <= 0 || ifindex >= nifaces || !ifaces[ifindex].ifindex)
+		return;
+
+	memset(&ifaces[ifindex], 0, sizeof(ifaces[ifindex]));
+	name_rehash(0);
+}
+
+static int iface_update(struct nlmsghdr *nlh, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct iface *iface;
+	bool renamed;
+
+	(void)arg;
+
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		iface_del(ifi->ifi_index);
+		return 0;
+	}
+	if (nlh->nlmsg_type != RTM_NEWLINK || ifi->ifi_index <= 0)
+		return 0;
+
+	nl_attr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+	if (!tb[IFLA_IFNAME])
+		return 0;
+
+	if (ifi->ifi_index >= nifaces) {
+		int num = nifaces ? nifaces : 64;
+
+		while (num <= ifi->ifi_index)
+			num *= 2;
+		iface = realloc(ifaces, num * sizeof(*iface));
+		if (!iface)
+			en_err(1, "Failed allocating interface cache");
+		memset(&iface[nifaces], 0, (num - nifaces) * sizeof(*iface));
+
+		ifaces = iface;
+		nifaces = num;
+	}
+
+	iface = &ifaces[ifi->ifi_index];
+	renamed = iface->ifindex && strcmp(iface->name, nl_attr_str(tb[IFLA_IFNAME]));
+
+	iface->flags = ifi->ifi_flags;
+	iface->type = ifi->ifi_type;
+	iface->mtu = tb[IFLA_MTU] ? nl_attr_u32(tb[IFLA_MTU]) : 0;
+	iface->master = tb[IFLA_MASTER] ? nl_attr_u32(tb[IFLA_MASTER]) : 0;
+	snprintf(iface->name, sizeof(iface->name), "%s", nl_attr_str(tb[IFLA_IFNAME]));
+
+	if (renamed)
+		name_rehash(0);
+	else if (!iface->ifindex) {
+		iface->ifindex = ifi->ifi_index;
+		if (2 * (nused + 1) > nnames)
+			name_rehash(nused + 1);
+		else
+			name_insert(ifi->ifi_index);
+	}
+
+	return 0;
+}
+
+static void iface_load(void)
+{
+	struct {
+		struct nlmsghdr  nh;
+		struct ifinfomsg ifi;
+		char             attr[16];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.nh.nlmsg_type  = RTM_GETLINK,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.ifi.ifi_family = AF_UNSPEC,
+	};
+
+	if (!iface_nl) {
+		iface_nl = nl_open(NETLINK_ROUTE);
+		if (!iface_nl)
+			en_err(1, "Failed opening netlink socket");
+	}
+
+	/* Only the basics, counters make up most of a link message */
+	nl_attr_put_u32(&req.nh, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+
+	if (nifaces)
+		memset(ifaces, 0, nifaces * sizeof(*ifaces));
+	name_rehash(0);
+
+	if (nl_query(iface_nl, &req.nh, iface_update, NULL))
+		en_err(1, "Failed reading interfaces");
+	loaded = true;
+}
+
+/*
+ * Keep the cache coherent for a long running process, from here on all
+ * link changes are applied by iface_sync().
+ */
+void iface_monitor(void)
+{
+	if (iface_mon)
+		return;
+
+	iface_mon = nl_open(NETLINK_ROUTE);
+	if (!iface_mon || nl_join(iface_mon, RTNLGRP_LINK)) {
+		warn("Failed monitoring interfaces, cache disabled");
+		return;
+	}
+	nl_set_rcvbuf(iface_mon, NL_RCVBUF);
+
+	/* Anything read before we subscribed may already be stale */
+	loaded = false;
+}
+
+/*
+ * Apply queued link notifications, called before each command.  If we
+ * missed some, the socket overran, start over with a new dump.
+ */
+void iface_sync(void)
+{
+	if (!iface_mon)
+		return;
+
+	if (nl_drain(iface_mon, iface_update, NULL))
+		loaded = false;
+}
+
+/*
+ * In a forked child, let go of the sockets shared with the parent, which
+ * goes on following changes.  The cache is kept as it was last synced.
+ */
+void iface_detach(void)
+{
+	nl_close(iface_nl);
+	iface_nl = NULL;
+	nl_close(iface_mon);
+	iface_mon = NULL;
+}
+
+/* Drop the cache, e.g. when done with a network namespace */
+void iface_flush(void)
+{
+	nl_close(iface_nl);
+	iface_nl = NULL;
+	free(ifaces);
+	ifaces = NULL;
+	nifaces = 0;
+	free(names);
+	names = NULL;
+	nnames = nused = 0;
+	loaded = false;
+}
+
+const struct iface *iface_get(int ifindex)
+{
+	if (!loaded)
+		iface_load();
+
+	if (ifindex <= 0 || ifindex >= nifaces || !ifaces[ifindex].ifindex)
+		return NULL;
+
+	return &ifaces[ifindex];
+}
+
+/* Walk the cache in ifindex order, start with 0 */
+const struct iface *iface_next(int ifindex)
+{
+	if (!loaded)
+		iface_load();
+
+	while (++ifindex < nifaces) {
+		if (ifaces[ifindex].ifindex)
+			return &ifaces[ifindex];
+	}
+
+	return NULL;
+}
+
+const char *en_ifname(int ifindex)
+{
+	static __thread char buf[IF_NAMESIZE];
+	const struct iface *iface;
+
+	iface = iface_get(ifindex);
+	if (iface)
+		return iface->name;
+
+	/* Created after the dump, without a monitor we would not know */
+	if (ifindex > 0 && if_indextoname(ifindex, buf))
+		return buf;
+
+	snprintf(buf, sizeof(buf), "if%d", ifindex);
+	return buf;
+}
+
+int en_ifindex(const char *ifname)
+{
+	size_t pos;
+
+	if (!loaded)
+		iface_load();
+
+	for (pos = name_hash(ifname); names[pos]; pos = (pos + 1) & (nnames - 1)) {
+		if (!strcmp(ifaces[names[pos]].name, ifname))
+			return names[pos];
+	}
+
+	/* Not in the cache, ask the kernel before giving up */
+	pos = if_nametoindex(ifname);
+	if (pos)
+		return pos;
+
+	en_errx(1, "%s: no such interface", ifname);
+}
@@ -0,0 +1,171 @@
+#include <stdint.h>
+
+#include "json.h"
+#include "out.h"
+
+#define JSON_MAXDEPTH 64
+
+static __thread uint64_t json_more;	/* Bit per level, set when a comma is due */
+static __thread int      json_depth;
+
+static void json_escape(const char *str)
+{
+	const unsigned char *p, *run;
+
+	out_char('"');
+	for (p = run = (const unsigned char *)str; *p; p++) {
+		if (*p >= 0x20 && *p != '"' && *p != '\\')
+			continue;
+
+		out_write(run, p - run);
+		run = p + 1;
+
+		switch (*p) {
+		case '"':
+			out_str("\\\"");
+			break;
+		case '\\':
+			out_str("\\\\");
+			break;
+		case '\n':
+			out_str("\\n");
+			break;
+		case '\t':
+			out_str("\\t");
+			break;
+		default:
+			out_str("\\u00");
+			out_char("0123456789abcdef"[*p >> 4]);
+			out_char("0123456789abcdef"[*p & 0xf]);
+		}
+	}
+	out_write(run, p - run);
+	out_char('"');
+}
+
+static void json_key(const char *key)
+{
+	uint64_t bit = 1ULL << json_depth;
+
+	if (json_more & bit)
+		out_char(',');
+	json_more |= bit;
+
+	if (key) {
+		json_escape(key);
+		out_char(':');
+	}
+}
+
+static void json_push(const char *key, int ch)
+{
+	json_key(key);
+	out_char(ch);
+
+	if (++json_depth >= JSON_MAXDEPTH)
+		json_depth = JSON_MAXDEPTH - 1;
+	json_more &= ~(1ULL << json_depth);
+}
+
+static void json_pop(int ch)
+{
+	if (json_depth > 0)
+		json_depth--;
+	out_char(ch);
+
+	/* Close of the outermost value, terminate the document */
+	if (!json_depth) {
+		json_more = 0;
+		out_char('\n');
+	}
+}
+
+/* Forget about any document left open by a failed command */
+void json_reset(void)
+{
+	json_more = 0;
+	json_depth = 0;
+}
+
+void json_begin_array(const char *key)
+{
+	json_push(key, '[');
+}
+
+void json_end_array(void)
+{
+	json_pop(']');
+}
+
+void json_begin_object(const char *key)
+{
+	json_push(key, '{');
+}
+
+void json_end_object(void)
+{
+	json_pop('}');
+}
+
+/* Insert an already formatted value, e.g. a document from a worker */
+void json_raw(const char *key, const char *val, size_t len)
+{
+	if (!len) {
+		json_null(key);
+		return;
+	}
+
+	json_key(key);
+	out_write(val, len);
+}
+
+void json_string(const char *key, const char *val)
+{
+	if (!val) {
+		json_null(key);
+		return;
+	}
+
+	json_key(key);
+	json_escape(val);
+}
+
+void json_int(const char *key, long long val)
+{
+	json_key(key);
+	out_s64(val);
+}
+
+void json_uint(const char *key, unsigned long long val)
+{
+	json_key(key);
+	out_u64(val);
+}
+
+void json_bool(const char *key, bool val)
+{
+	json_key(key);
+	out_str(val ? "true" : "false");
+}
+
+void json_null(const char *key)
+{
+	json_key(key);
+	out_str("null");
+}
+
+void json_mac(const char *key, const unsigned char *mac)
+{
+	json_key(key);
+	out_char('"');
+	out_mac(mac);
+	out_char('"');
+}
+
+void json_addr(const char *key, int family, const void *addr)
+{
+	json_key(key);
+	out_char('"');
+	out_addr(family, addr);
+	out_char('"');
+}
@@ -0,0 +1,29 @@
+#ifndef EN_JSON_H_
+#define EN_JSON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Streaming JSON writer.  Values are written out as soon as they are
+ * added, nothing is kept in memory except one bit per nesting level.
+ * The @key argument is NULL for array members.
+ */
+void json_reset(void);
+
+void json_begin_array (const char *key);
+void json_end_array   (void);
+void json_begin_object(const char *key);
+void json_end_object  (void);
+
+void json_string(const char *key, const char *val);
+void json_int   (const char *key, long long val);
+void json_uint  (const char *key, unsigned long long val);
+void json_bool  (const char *key, bool val);
+void json_null  (const char *key);
+void json_raw   (const char *key, const char *val, size_t len);
+
+void json_mac   (const char *key, const unsigned char *mac);
+void json_addr  (const char *key, int family, const void *addr);
+
+#endif /* EN_JSON_H_ */
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include "en.h"
+
+static void link_set(ArgParser *ap)
+{
+	struct {
+		struct nlmsghdr  nh;
+		struct ifinfomsg ifi;
+		char             attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.nh.nlmsg_type  = RTM_NEWLINK,
+		.ifi.ifi_family = AF_UNSPEC,
+	};
+	int i, argc = ap_len_args(ap);
+
+	if (argc < 1)
+		en_errx(1, "missing interface name");
+	req.ifi.ifi_index = en_ifindex(ap_get_arg(ap, 0));
+
+	for (i = 1; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+
+		if (!strcmp(arg, "up")) {
+			req.ifi.ifi_change |= IFF_UP;
+			req.ifi.ifi_flags |= IFF_UP;
+		} else if (!strcmp(arg, "down")) {
+			req.ifi.ifi_change |= IFF_UP;
+			req.ifi.ifi_flags &= ~IFF_UP;
+		} else if (!strcmp(arg, "mtu")) {
+			unsigned long mtu;
+			char *end;
+
+			if (++i >= argc)
+				en_errx(1, "missing argument to '%s'", arg);
+
+			mtu = strtoul(ap_get_arg(ap, i), &end, 10);
+			if (*end || !mtu || mtu > UINT32_MAX)
+				en_errx(1, "invalid mtu '%s'", ap_get_arg(ap, i));
+			nl_attr_put_u32(&req.nh, sizeof(req), IFLA_MTU, mtu);
+		} else
+			en_errx(1, "unknown argument '%s'", arg);
+	}
+
+	en_tx(&req.nh);
+}
+
+static void link_cmds(ArgParser *link)
+{
+	ap_add_cmd(link, "set", "Change interface: IFNAME [up|down] [mtu N]", link_set);
+}
+
+int link_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "link", "Network interface management", link_cmds, NULL);
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/neighbour.h>
+
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+
+struct neigh_filter {
+	bool            json;
+	bool            none;		/* Include entries in NUD_NONE */
+	uint16_t        state;
+	struct filter  *flt;
+
+	/* Entry being filtered */
+	struct ndmsg   *ndm;
+	struct rtattr **tb;
+};
+
+enum {
+	NF_DST, NF_DEV, NF_LLADDR, NF_STATE, NF_ROUTER,
+};
+
+static const struct filter_field neigh_fields[] = {
+	{ "dst",    NF_DST,    FILTER_STR },
+	{ "dev",    NF_DEV,    FILTER_STR },
+	{ "lladdr", NF_LLADDR, FILTER_STR },
+	{ "state",  NF_STATE,  FILTER_STR },
+	{ "router", NF_ROUTER, FILTER_NUM },
+};
+
+static const struct {
+	uint16_t    state;
+	const char *name;
+} states[] = {
+	{ NUD_INCOMPLETE, "incomplete" },
+	{ NUD_REACHABLE,  "reachable"  },
+	{ NUD_STALE,      "stale"      },
+	{ NUD_DELAY,      "delay"      },
+	{ NUD_PROBE,      "probe"      },
+	{ NUD_FAILED,     "failed"     },
+	{ NUD_NOARP,      "noarp"      },
+	{ NUD_PERMANENT,  "permanent"  },
+};
+
+static void neigh_state(struct neigh_filter *f, const char *name)
+{
+	size_t i;
+
+	if (!strcmp(name, "all")) {
+		f->state = 0xff;
+		f->none = true;
+		return;
+	}
+	if (!strcmp(name, "none")) {
+		f->none = true;
+		return;
+	}
+
+	for (i = 0; i < NELEMS(states); i++) {
+		if (!strcmp(states[i].name, name)) {
+			f->state |= states[i].state;
+			return;
+		}
+	}
+
+	en_errx(1, "invalid neighbor state '%s'", name);
+}
+
+static void neigh_field(void *rec, int id, struct filter_val *val)
+{
+	struct neigh_filter *f = rec;
+	struct ndmsg *ndm = f->ndm;
+	struct rtattr **tb = f->tb;
+	size_t i;
+
+	switch (id) {
+	case NF_DST:
+		if (inet_ntop(ndm->ndm_family, RTA_DATA(tb[NDA_DST]), val->buf, sizeof(val->buf)))
+			val->str = val->buf;
+		break;
+	case NF_DEV:
+		val->str = en_ifname(ndm->ndm_ifindex);
+		break;
+	case NF_LLADDR:
+		if (tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == 6)
+			val->str = out_fmt_mac(val->buf, RTA_DATA(tb[NDA_LLADDR]));
+		break;
+	case NF_STATE:
+		/* Entries are in one state, except with NUD_NOARP and friends */
+		for (i = 0; i < NELEMS(states); i++) {
+			if (ndm->ndm_state & states[i].state) {
+				val->str = states[i].name;
+				break;
+			}
+		}
+		break;
+	case NF_ROUTER:
+		val->num = !!(ndm->ndm_flags & NTF_ROUTER);
+		break;
+	}
+}
+
+static void neigh_show_json(struct ndmsg *ndm, struct rtattr *tb[])
+{
+	size_t i;
+
+	json_begin_object(NULL);
+	json_addr("dst", ndm->ndm_family, RTA_DATA(tb[NDA_DST]));
+	json_string("dev", en_ifname(ndm->ndm_ifindex));
+	if (tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == 6)
+		json_mac("lladdr", RTA_DATA(tb[NDA_LLADDR]));
+	if (ndm->ndm_flags & NTF_ROUTER)
+		json_bool("router", true);
+
+	json_begin_array("state");
+	for (i = 0; i < NELEMS(states); i++) {
+		if (ndm->ndm_state & states[i].state)
+			json_string(NULL, states[i].name);
+	}
+	json_end_array();
+	json_end_object();
+}
+
+static void neigh_show_text(struct ndmsg *ndm, struct rtattr *tb[])
+{
+	size_t i;
+
+	out_addr(ndm->ndm_family, RTA_DATA(tb[NDA_DST]));
+	out_str(" dev ");
+	out_str(en_ifname(ndm->ndm_ifindex));
+	if (tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == 6) {
+		out_str(" lladdr ");
+		out_mac(RTA_DATA(tb[NDA_LLADDR]));
+	}
+	if (ndm->ndm_flags & NTF_ROUTER)
+		out_str(" router");
+
+	for (i = 0; i < NELEMS(states); i++) {
+		if (!(ndm->ndm_state & states[i].state))
+			continue;
+		out_char(' ');
+		out_str(states[i].name);
+	}
+	out_char('\n');
+}
+
+static int neigh_show_one(struct nlmsghdr *nlh, void *arg)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct neigh_filter *f = arg;
+	struct rtattr *tb[NDA_MAX + 1];
+
+	if (nlh->nlmsg_type != RTM_NEWNEIGH)
+		return 0;
+	if (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)
+		return 0;
+
+	/* The kernel cannot filter on state, drop before decoding */
+	if (ndm->ndm_state ? !(ndm->ndm_state & f->state) : !f->none)
+		return 0;
+
+	nl_attr_parse(tb, NDA_MAX, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+	if (!tb[NDA_DST])
+		return 0;
+
+	f->ndm = ndm;
+	f->tb = tb;
+	if (!filter_match(f->flt, neigh_field, f))
+		return 0;
+
+	if (f->json)
+		neigh_show_json(ndm, tb);
+	else
+		neigh_show_text(ndm, tb);
+
+	return 0;
+}
+
+static void neigh_show(ArgParser *ap)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ndmsg    ndm;
+		char            attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.nh.nlmsg_type  = RTM_GETNEIGH,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.ndm.ndm_family = AF_UNSPEC,
+	};
+	struct neigh_filter f = {
+		.json  = en_json(),
+		.state = ~(NUD_NOARP | NUD_NONE) & 0xff,
+		.flt   = en_filter(neigh_fields, NELEMS(neigh_fields)),
+	};
+	int i, argc = ap_len_args(ap);
+	bool state = false;
+
+	for (i = 0; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+
+		if (++i >= argc)
+			en_errx(1, "missing argument to '%s'", arg);
+
+		if (!strcmp(arg, "dev"))
+			nl_attr_put_u32(&req.nh, sizeof(req), NDA_IFINDEX, en_ifindex(ap_get_arg(ap, i)));
+		else if (!strcmp(arg, "state")) {
+			if (!state)
+				f.state = 0;
+			state = true;
+			neigh_state(&f, ap_get_arg(ap, i));
+		} else
+			en_errx(1, "unknown argument '%s'", arg);
+	}
+
+	if (f.json)
+		json_begin_array(NULL);
+	if (nl_query(en_rtnl(), &req.nh, neigh_show_one, &f))
+		en_err(1, "Failed reading neighbors");
+	if (f.json)
+		json_end_array();
+}
+
+static void neigh_cmds(ArgParser *neigh)
+{
+	filter_cmd(ap_add_cmd(neigh, "show list", "Show neighbors: [dev IFNAME] [state STATE]...", neigh_show));
+}
+
+int neigh_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "neigh", "Neighbor (ARP/NDP) table management", neigh_cmds, NULL);
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE		/* setns() */
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+#include "pool.h"
+
+#define NETNS_RUN_DIR	"/run/netns"
+#define NETNS_WORKERS	64
+
+struct netns {
+	char    *name;
+	char    *out;		/* Captured output */
+	size_t   len;
+	int      status;
+	char    *err;		/* Error message, if status is set */
+};
+
+struct netns_run {
+	ArgParser     *ap;
+	void         (*cb)(ArgParser *ap);
+	bool           json;
+	int            status;
+
+	struct netns  *ns;
+	size_t         num;
+	size_t         max;
+};
+
+static __thread bool worker;
+static ApOpt        *opt_netns;
+static ApOpt        *opt_all;
+
+/* For commands that cannot run in a worker, like the shell */
+bool netns_worker(void)
+{
+	return worker;
+}
+
+static void netns_add(struct netns_run *run, const char *name)
+{
+	if (run->num == run->max) {
+		struct netns *ns;
+
+		run->max = run->max ? run->max * 2 : 16;
+		ns = realloc(run->ns, run->max * sizeof(*ns));
+		if (!ns)
+			en_err(1, "Failed allocating namespaces");
+		run->ns = ns;
+	}
+
+	memset(&run->ns[run->num], 0, sizeof(run->ns[0]));
+	run->ns[run->num].name = strdup(name);
+	if (!run->ns[run->num].name)
+		en_err(1, "Failed allocating namespaces");
+	run->num++;
+}
+
+static int netns_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct netns *)a)->name, ((const struct netns *)b)->name);
+}
+
+/* Same as ip netns, sorted by name so the output order is stable */
+static void netns_all(struct netns_run *run)
+{
+	struct dirent *d;
+	DIR *dir;
+
+	dir = opendir(NETNS_RUN_DIR);
+	if (!dir) {
+		if (errno == ENOENT)
+			return;
+		en_err(1, "%s", NETNS_RUN_DIR);
+	}
+
+	while ((d = readdir(dir))) {
+		if (d->d_name[0] == '.')
+			continue;
+		netns_add(run, d->d_name);
+	}
+	closedir(dir);
+
+	qsort(run->ns, run->num, sizeof(run->ns[0]), netns_cmp);
+}
+
+static void netns_list(struct netns_run *run, const char *list)
+{
+	char *copy, *name, *ptr;
+
+	copy = strdup(list);
+	if (!copy)
+		en_err(1, "Failed allocating namespaces");
+
+	for (name = strtok_r(copy, ",", &ptr); name; name = strtok_r(NULL, ",", &ptr))
+		netns_add(run, name);
+	free(copy);
+}
+
+/* Runs in a worker thread, output is collected for netns_done() */
+static void netns_job(size_t idx, void *arg)
+{
+	struct netns_run *run = arg;
+	struct netns *ns = &run->ns[idx];
+	char path[PATH_MAX];
+	int fd;
+
+	worker = true;
+	en_set_label(ns->name);
+	en_set_tag(ns->name);
+	out_capture();
+
+	if (strchr(ns->name, '/'))
+		snprintf(path, sizeof(path), "%s", ns->name);
+	else
+		snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, ns->name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || setns(fd, CLONE_NEWNET)) {
+		warnx("%s: %s", ns->name, strerror(errno));
+		ns->err = strdup(strerror(errno));
+		ns->status = 1;
+	} else {
+		ns->status = en_run_cb(run->ap, run->cb);
+		if (ns->status && *en_error())
+			ns->err = strdup(en_error());
+	}
+	if (fd >= 0)
+		close(fd);
+
+	ns->out = out_captured(&ns->len);
+	iface_flush();
+	filter_release();
+	json_reset();
+	en_set_tag(NULL);
+	en_set_label(NULL);
+}
+
+/*
+ * Called in namespace order, emit the output with a label.  What a failed
+ * command wrote may be cut off anywhere, e.g. half a JSON array, so only
+ * its error is shown.
+ */
+static void netns_done(size_t idx, void *arg)
+{
+	struct netns_run *run = arg;
+	struct netns *ns = &run->ns[idx];
+	const char *err = ns->err ? ns->err : "failed";
+
+	if (run->json && ns->status) {
+		json_begin_object(NULL);
+		json_string("netns", ns->name);
+		json_null("result");
+		json_string("error", err);
+		json_end_object();
+	} else if (run->json) {
+		/* A worker's document ends with a newline, we are not done */
+		if (ns->len && ns->out[ns->len - 1] == '\n')
+			ns->len--;
+
+		json_begin_object(NULL);
+		json_string("netns", ns->name);
+		json_raw("result", ns->out, ns->len);
+		json_end_object();
+	} else {
+		out_str("netns: ");
+		out_str(ns->name);
+		if (ns->status) {
+			out_str(": error: ");
+			out_str(err);
+		}
+		out_char('\n');
+		if (!ns->status)
+			out_write(ns->out, ns->len);
+	}
+
+	if (ns->status)
+		run->status = ns->status;
+
+	free(ns->out);
+	ns->out = NULL;
+	free(ns->err);
+	ns->err = NULL;
+}
+
+static int netns_workers(size_t num)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max;
+
+	/* Mostly waiting on the kernel, use more threads than CPUs */
+	max = cpus > 0 ? 4 * cpus : 4;
+	if (max > NETNS_WORKERS)
+		max = NETNS_WORKERS;
+
+	return num < max ? num : max;
+}
+
+/*
+ * Command hook, with --all-netns or --netns the command's callback runs
+ * once per namespace on a pool of worker threads, each thread switching
+ * to the namespace with setns().  Results are merged in namespace order.
+ */
+static void netns_hook(ArgParser *ap, void (*cb)(ArgParser *ap))
+{
+	struct netns_run run = {
+		.ap   = ap,
+		.cb   = cb,
+		.json = en_json(),
+	};
+	const char *list;
+	size_t i;
+
+	/* Every command goes through here, check once before fanning out */
+	filter_check(ap);
+
+	list = ap_opt_get_str(opt_netns);
+	if (worker || (!list && !ap_opt_get_flag(opt_all))) {
+		cb(ap);
+		return;
+	}
+
+	if (list)
+		netns_list(&run, list);
+	else
+		netns_all(&run);
+	if (!run.num)
+		en_errx(1, "no network namespaces");
+
+	if (run.json)
+		json_begin_array(NULL);
+	if (pool_run(run.num, netns_workers(run.num), netns_job, netns_done, &run)) {
+		warn("Failed starting namespace workers");
+		run.status = 1;
+	}
+	if (run.json)
+		json_end_array();
+
+	for (i = 0; i < run.num; i++)
+		free(run.ns[i].name);
+	free(run.ns);
+
+	if (run.status)
+		en_exit(run.status);
+}
+
+int netns_init(ArgParser *ap)
+{
+	opt_netns = ap_add_str(ap, "netns n", NULL);
+	opt_all = ap_add_flag(ap, "all-netns");
+	ap_set_cmd_hook(netns_hook);
+
+	return 0;
+}
@@ -0,0 +1,424 @@
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "nl.h"
+
+struct nl *nl_open(int proto)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+	socklen_t len = sizeof(sa);
+	struct nl *nl;
+	int one = 1;
+
+	nl = calloc(1, sizeof(*nl));
+	if (!nl)
+		return NULL;
+
+	nl->bufsz = NL_BUFSZ;
+	nl->buf = malloc(nl->bufsz);
+	if (!nl->buf)
+		goto fail;
+
+	nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, proto);
+	if (nl->fd < 0)
+		goto fail;
+
+	if (bind(nl->fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+	    getsockname(nl->fd, (struct sockaddr *)&sa, &len)) {
+		close(nl->fd);
+		goto fail;
+	}
+
+	/* Let the kernel filter dumps for us, older kernels ignore this */
+	setsockopt(nl->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+	/* Keep ACKs small, we match them by sequence number anyway */
+	setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	nl->pid = sa.nl_pid;
+	nl->seq = time(NULL);
+
+	return nl;
+fail:
+	free(nl->buf);
+	free(nl);
+	return NULL;
+}
+
+void nl_close(struct nl *nl)
+{
+	if (!nl)
+		return;
+
+	close(nl->fd);
+	free(nl->txbuf);
+	free(nl->pend);
+	free(nl->buf);
+	free(nl);
+}
+
+int nl_join(struct nl *nl, int group)
+{
+	return setsockopt(nl->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group));
+}
+
+/* Privileged users may go beyond net.core.rmem_max */
+int nl_set_rcvbuf(struct nl *nl, int size)
+{
+	if (!setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+		return 0;
+
+	return setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+/*
+ * Peek at the size of the next datagram, without copying it, and grow
+ * the receive buffer if needed.  Messages are never truncated this way
+ * while the buffer stays at a size that lets the kernel pack each dump
+ * skb full.
+ */
+static ssize_t nl_recv(struct nl *nl, int flags)
+{
+	ssize_t len;
+
+	while (1) {
+		len = recv(nl->fd, NULL, 0, MSG_PEEK | MSG_TRUNC | flags);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if ((size_t)len > nl->bufsz) {
+			char *buf;
+
+			buf = realloc(nl->buf, len);
+			if (!buf)
+				return -1;
+			nl->buf = buf;
+			nl->bufsz = len;
+		}
+
+		len = recv(nl->fd, nl->buf, nl->bufsz, flags);
+		if (len >= 0 || errno != EINTR)
+			return len;
+	}
+}
+
+static int nl_send(struct nl *nl, struct nlmsghdr *req)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	req->nlmsg_seq = ++nl->seq;
+	req->nlmsg_pid = 0;
+
+	while (sendto(nl->fd, req, req->nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int nl_tx_send(struct nl *nl)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	if (!nl->txlen)
+		return 0;
+
+	while (sendto(nl->fd, nl->txbuf, nl->txlen, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	nl->txlen = 0;
+
+	return 0;
+}
+
+static void nl_tx_ack(struct nl *nl, struct nlmsghdr *nlh)
+{
+	struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+	/* ACKs arrive in order, retire everything up to this one */
+	while (nl->plen) {
+		struct nl_pending *p = &nl->pend[nl->phead];
+
+		if ((int32_t)(nlh->nlmsg_seq - p->seq) < 0)
+			break;
+
+		if (p->seq == nlh->nlmsg_seq && e->error) {
+			if (p->tag[0])
+				warnx("%s: %s", p->tag, strerror(-e->error));
+			else
+				warnx("%s", strerror(-e->error));
+			nl->errors++;
+		}
+
+		nl->phead = (nl->phead + 1) % NL_TXMAX;
+		nl->plen--;
+	}
+}
+
+/* Collect ACKs, wait until at most @max requests are still outstanding */
+static int nl_tx_collect(struct nl *nl, size_t max)
+{
+	while (nl->plen > max) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = nl_recv(nl, 0);
+		if (len < 0)
+			return -1;
+
+		for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR && nlh->nlmsg_pid == nl->pid)
+				nl_tx_ack(nl, nlh);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Queue a change request.  Requests are packed back to back and sent
+ * many at a time in one sendmsg(), the kernel handles them in order and
+ * answers each with an ACK which we match to @tag by sequence number
+ * when collecting them, either when the pipeline is full or on flush.
+ */
+int nl_tx(struct nl *nl, struct nlmsghdr *req, const char *tag)
+{
+	struct nl_pending *p;
+
+	if (!nl->txbuf) {
+		nl->txbuf = malloc(NL_TXBUFSZ);
+		nl->pend = malloc(NL_TXMAX * sizeof(*nl->pend));
+		if (!nl->txbuf || !nl->pend)
+			return -1;
+	}
+
+	if (nl->txlen + NLMSG_ALIGN(req->nlmsg_len) > NL_TXBUFSZ && nl_tx_send(nl))
+		return -1;
+
+	if (nl->plen == NL_TXMAX) {
+		if (nl_tx_send(nl) || nl_tx_collect(nl, NL_TXMAX / 2))
+			return -1;
+	}
+
+	req->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+	req->nlmsg_seq = ++nl->seq;
+	req->nlmsg_pid = 0;
+	memcpy(&nl->txbuf[nl->txlen], req, req->nlmsg_len);
+	nl->txlen += NLMSG_ALIGN(req->nlmsg_len);
+
+	p = &nl->pend[(nl->phead + nl->plen++) % NL_TXMAX];
+	p->seq = req->nlmsg_seq;
+	snprintf(p->tag, sizeof(p->tag), "%s", tag ? tag : "");
+
+	return 0;
+}
+
+/* Send all queued requests and wait for every outstanding ACK */
+static void nl_tx_sync(struct nl *nl)
+{
+	if (!nl->txlen && !nl->plen)
+		return;
+
+	if (nl_tx_send(nl) || nl_tx_collect(nl, 0)) {
+		warn("Failed applying changes");
+		nl->txlen = 0;
+		nl->plen = 0;
+		nl->errors++;
+	}
+}
+
+/*
+ * Like nl_tx_sync() but also returns the number of requests that failed
+ * since the last flush.  Failures have already been reported with tag.
+ */
+int nl_tx_flush(struct nl *nl)
+{
+	int errors;
+
+	nl_tx_sync(nl);
+
+	errors = nl->errors;
+	nl->errors = 0;
+
+	return errors;
+}
+
+/*
+ * Send a request and feed each reply to @cb as soon as it is received.
+ * Works both for dumps, which end with NLMSG_DONE, and for plain get
+ * requests answered by a single message.  If @cb bails out we keep on
+ * draining the socket until the kernel is done, so it can be reused.
+ */
+int nl_query(struct nl *nl, struct nlmsghdr *req, nl_cb_t cb, void *arg)
+{
+	int rc = 0, done = 0;
+
+	/* Changes must be applied before we look at the result */
+	nl_tx_sync(nl);
+
+	if (nl_send(nl, req))
+		return -1;
+
+	nl->busy = 1;
+	while (!done) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = nl_recv(nl, 0);
+		if (len < 0) {
+			nl->busy = 0;
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != nl->seq || nlh->nlmsg_pid != nl->pid)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+				if (e->error && !rc) {
+					errno = -e->error;
+					rc = -1;
+				}
+				done = 1;
+				break;
+			}
+
+			if (!rc && cb(nlh, arg) < 0)
+				rc = -1;
+
+			if (!(nlh->nlmsg_flags & NLM_F_MULTI))
+				done = 1;
+		}
+	}
+	nl->busy = 0;
+
+	return rc;
+}
+
+void nl_attr_put(struct nlmsghdr *nlh, size_t maxlen, int type, const void *data, size_t len)
+{
+	struct rtattr *rta;
+	size_t rtalen = RTA_LENGTH(len);
+
+	if (NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rtalen) > maxlen)
+		abort();
+
+	rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = rtalen;
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rtalen);
+}
+
+void nl_attr_put_u32(struct nlmsghdr *nlh, size_t maxlen, int type, uint32_t val)
+{
+	nl_attr_put(nlh, maxlen, type, &val, sizeof(val));
+}
+
+void nl_attr_put_str(struct nlmsghdr *nlh, size_t maxlen, int type, const char *str)
+{
+	nl_attr_put(nlh, maxlen, type, str, strlen(str) + 1);
+}
+
+/* Start a nested attribute, close it with nl_attr_nest_end() */
+struct rtattr *nl_attr_nest(struct nlmsghdr *nlh, size_t maxlen, int type)
+{
+	struct rtattr *nest = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	nl_attr_put(nlh, maxlen, type | NLA_F_NESTED, NULL, 0);
+
+	return nest;
+}
+
+void nl_attr_nest_end(struct nlmsghdr *nlh, struct rtattr *nest)
+{
+	nest->rta_len = (char *)nlh + nlh->nlmsg_len - (char *)nest;
+}
+
+void nl_attr_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len)
+{
+	memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		unsigned short type = rta->rta_type & ~NLA_F_NESTED;
+
+		if (type <= max && !tb[type])
+			tb[type] = rta;
+	}
+}
+
+static int nl_genl_id(struct nlmsghdr *nlh, void *arg)
+{
+	struct genlmsghdr *genl = NLMSG_DATA(nlh);
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+	int *id = arg;
+
+	nl_attr_parse(tb, CTRL_ATTR_MAX, (struct rtattr *)((char *)genl + GENL_HDRLEN),
+		      nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+	if (tb[CTRL_ATTR_FAMILY_ID])
+		*id = *(uint16_t *)RTA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+
+	return 0;
+}
+
+/* Look up the id of a generic netlink family, -1 if it does not exist */
+int nl_genl_family(struct nl *nl, const char *name)
+{
+	struct {
+		struct nlmsghdr   nh;
+		struct genlmsghdr genl;
+		char              attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(GENL_HDRLEN),
+		.nh.nlmsg_type  = GENL_ID_CTRL,
+		.nh.nlmsg_flags = NLM_F_REQUEST,
+		.genl.cmd       = CTRL_CMD_GETFAMILY,
+		.genl.version   = 1,
+	};
+	int id = -1;
+
+	nl_attr_put_str(&req.nh, sizeof(req), CTRL_ATTR_FAMILY_NAME, name);
+	if (nl_query(nl, &req.nh, nl_genl_id, &id))
+		return -1;
+
+	return id;
+}
+
+/*
+ * Feed all messages already queued on a socket subscribed to multicast
+ * groups to @cb, without blocking.  Fails with ENOBUFS if the kernel had
+ * to drop any, then the caller must resync its view with a dump.
+ */
+int nl_drain(struct nl *nl, nl_cb_t cb, void *arg)
+{
+	while (1) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = nl_recv(nl, MSG_DONTWAIT);
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+			cb(nlh, arg);
+	}
+}
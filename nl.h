@@ -0,0 +1,83 @@
+#ifndef EN_NL_H_
+#define EN_NL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define NL_BUFSZ	32768		/* Largest dump skb the kernel sends */
+#define NL_RCVBUF	(4 << 20)
+#define NL_TXBUFSZ	32768		/* Max requests per sendmsg() */
+#define NL_TXMAX	1024		/* Max requests awaiting ACK */
+#define NL_TAGSZ	48
+
+struct nl_pending {
+	uint32_t  seq;
+	char      tag[NL_TAGSZ];
+};
+
+struct nl {
+	int       fd;
+	uint32_t  pid;
+	uint32_t  seq;
+	int       busy;		/* Reply still in flight */
+
+	char     *buf;
+	size_t    bufsz;
+
+	/* Write pipeline */
+	char     *txbuf;
+	size_t    txlen;
+	struct nl_pending *pend;	/* Ring buffer, in seq order */
+	size_t    phead;
+	size_t    plen;
+	int       errors;
+};
+
+/* Called once per decoded message, return < 0 to stop the dump */
+typedef int (*nl_cb_t)(struct nlmsghdr *nlh, void *arg);
+
+struct nl *nl_open(int proto);
+void       nl_close(struct nl *nl);
+
+int  nl_join(struct nl *nl, int group);
+int  nl_set_rcvbuf(struct nl *nl, int size);
+
+int  nl_query(struct nl *nl, struct nlmsghdr *req, nl_cb_t cb, void *arg);
+int  nl_drain(struct nl *nl, nl_cb_t cb, void *arg);
+
+int  nl_genl_family(struct nl *nl, const char *name);
+
+int  nl_tx(struct nl *nl, struct nlmsghdr *req, const char *tag);
+int  nl_tx_flush(struct nl *nl);
+
+void nl_attr_put(struct nlmsghdr *nlh, size_t maxlen, int type, const void *data, size_t len);
+void nl_attr_put_u32(struct nlmsghdr *nlh, size_t maxlen, int type, uint32_t val);
+void nl_attr_put_str(struct nlmsghdr *nlh, size_t maxlen, int type, const char *str);
+
+struct rtattr *nl_attr_nest(struct nlmsghdr *nlh, size_t maxlen, int type);
+void           nl_attr_nest_end(struct nlmsghdr *nlh, struct rtattr *nest);
+
+void nl_attr_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len);
+
+static inline uint32_t nl_attr_u32(const struct rtattr *rta)
+{
+	return *(const uint32_t *)RTA_DATA(rta);
+}
+
+static inline uint64_t nl_attr_u64(const struct rtattr *rta)
+{
+	uint64_t val;
+
+	__builtin_memcpy(&val, RTA_DATA(rta), sizeof(val));
+	return val;
+}
+
+static inline const char *nl_attr_str(const struct rtattr *rta)
+{
+	return (const char *)RTA_DATA(rta);
+}
+
+#endif /* EN_NL_H_ */
@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "out.h"
+
+/* Per thread, workers format output for one network namespace each */
+static __thread char   out_buf[OUT_BUFSZ];
+static __thread size_t out_len;
+
+static __thread struct {
+	bool    on;
+	char   *buf;
+	size_t  len;
+	size_t  size;
+} cap;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static void out_append(struct iovec *iov, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (cap.len + iov[i].iov_len > cap.size) {
+			size_t size = cap.size ? cap.size : OUT_BUFSZ;
+			char *buf;
+
+			while (size < cap.len + iov[i].iov_len)
+				size *= 2;
+			buf = realloc(cap.buf, size);
+			if (!buf)
+				return;	/* Truncated, like a failed write */
+			cap.buf = buf;
+			cap.size = size;
+		}
+		memcpy(&cap.buf[cap.len], iov[i].iov_base, iov[i].iov_len);
+		cap.len += iov[i].iov_len;
+	}
+}
+
+static void out_writev(struct iovec *iov, int cnt)
+{
+	if (cap.on) {
+		out_append(iov, cnt);
+		return;
+	}
+
+	while (cnt > 0) {
+		ssize_t len;
+
+		len = writev(STDOUT_FILENO, iov, cnt);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return;	/* EPIPE et al, nobody is listening */
+		}
+
+		while (cnt > 0 && (size_t)len >= iov->iov_len) {
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+}
+
+void out_flush(void)
+{
+	struct iovec iov = { out_buf, out_len };
+
+	/* Keep order with anything printed using stdio, e.g. --help */
+	fflush(stdout);
+	if (!out_len)
+		return;
+
+	out_writev(&iov, 1);
+	out_len = 0;
+}
+
+/* Collect all output from this thread in memory, until out_captured() */
+void out_capture(void)
+{
+	out_flush();
+	cap.on = true;
+}
+
+/* Stop capturing, returns the output, which the caller must free() */
+char *out_captured(size_t *len)
+{
+	char *buf;
+
+	out_flush();
+	buf = cap.buf;
+	*len = cap.len;
+	memset(&cap, 0, sizeof(cap));
+
+	return buf;
+}
+
+/* Make room for @len bytes, @len must not exceed OUT_BUFSZ */
+static char *out_reserve(size_t len)
+{
+	if (out_len + len > sizeof(out_buf))
+		out_flush();
+
+	return &out_buf[out_len];
+}
+
+void out_write(const void *data, size_t len)
+{
+	if (out_len + len <= sizeof(out_buf)) {
+		memcpy(&out_buf[out_len], data, len);
+		out_len += len;
+		return;
+	}
+
+	/* Large payload, send buffered data and payload in one go */
+	if (len >= sizeof(out_buf) / 2) {
+		struct iovec iov[2] = {
+			{ out_buf,      out_len },
+			{ (void *)data, len     },
+		};
+
+		out_writev(iov, 2);
+		out_len = 0;
+		return;
+	}
+
+	out_flush();
+	memcpy(out_buf, data, len);
+	out_len = len;
+}
+
+void out_str(const char *str)
+{
+	out_write(str, strlen(str));
+}
+
+void out_char(int ch)
+{
+	char *p = out_reserve(1);
+
+	*p = ch;
+	out_len++;
+}
+
+void out_pad(int num)
+{
+	while (num-- > 0)
+		out_char(' ');
+}
+
+void out_u64(uint64_t val)
+{
+	char tmp[20], *p = &tmp[sizeof(tmp)];
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	out_write(p, &tmp[sizeof(tmp)] - p);
+}
+
+void out_s64(int64_t val)
+{
+	if (val < 0) {
+		out_char('-');
+		out_u64(-(uint64_t)val);
+	} else
+		out_u64(val);
+}
+
+void out_hex(uint64_t val)
+{
+	char tmp[16], *p = &tmp[sizeof(tmp)];
+
+	do {
+		*--p = hexdigits[val & 0xf];
+		val >>= 4;
+	} while (val);
+
+	out_write(p, &tmp[sizeof(tmp)] - p);
+}
+
+/* Format @mac into @buf, which must hold OUT_MACSZ, NUL terminated */
+char *out_fmt_mac(char *buf, const unsigned char *mac)
+{
+	char *p = buf;
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		if (i)
+			*p++ = ':';
+		*p++ = hexdigits[mac[i] >> 4];
+		*p++ = hexdigits[mac[i] & 0xf];
+	}
+	*p = 0;
+
+	return buf;
+}
+
+void out_mac(const unsigned char *mac)
+{
+	/* Room for the NUL, which is not counted */
+	out_fmt_mac(out_reserve(OUT_MACSZ), mac);
+	out_len += OUT_MACSZ - 1;
+}
+
+static char *fmt_u8(char *p, unsigned int val)
+{
+	if (val >= 100)
+		*p++ = '0' + val / 100;
+	if (val >= 10)
+		*p++ = '0' + val / 10 % 10;
+	*p++ = '0' + val % 10;
+
+	return p;
+}
+
+void out_ipv4(const void *addr)
+{
+	const unsigned char *a = addr;
+	char *start = out_reserve(15), *p = start;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (i)
+			*p++ = '.';
+		p = fmt_u8(p, a[i]);
+	}
+	out_len += p - start;
+}
+
+/* RFC 5952 text form: lower case, longest run of zero groups elided */
+void out_ipv6(const void *addr)
+{
+	const unsigned char *a = addr;
+	char *start = out_reserve(45), *p = start;
+	int best = -1, bestlen = 1, run = 0;
+	uint16_t w[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = a[2 * i] << 8 | a[2 * i + 1];
+		if (w[i]) {
+			run = 0;
+			continue;
+		}
+		if (++run > bestlen) {
+			bestlen = run;
+			best = i - run + 1;
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (i == best) {
+			*p++ = ':';
+			if (i == 0)
+				*p++ = ':';
+			i += bestlen - 1;
+			continue;
+		}
+
+		/* IPv4-mapped and -compatible addresses */
+		if (i == 6 && best == 0 && (bestlen == 6 || (bestlen == 5 && w[5] == 0xffff))) {
+			p = fmt_u8(p, a[12]);
+			*p++ = '.';
+			p = fmt_u8(p, a[13]);
+			*p++ = '.';
+			p = fmt_u8(p, a[14]);
+			*p++ = '.';
+			p = fmt_u8(p, a[15]);
+			break;
+		}
+
+		if (w[i] >= 0x1000)
+			*p++ = hexdigits[w[i] >> 12];
+		if (w[i] >= 0x100)
+			*p++ = hexdigits[(w[i] >> 8) & 0xf];
+		if (w[i] >= 0x10)
+			*p++ = hexdigits[(w[i] >> 4) & 0xf];
+		*p++ = hexdigits[w[i] & 0xf];
+		if (i < 7)
+			*p++ = ':';
+	}
+	out_len += p - start;
+}
+
+void out_addr(int family, const void *addr)
+{
+	if (family == AF_INET6)
+		out_ipv6(addr);
+	else
+		out_ipv4(addr);
+}
+
+void out_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(&out_buf[out_len], sizeof(out_buf) - out_len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+
+	if (out_len + len < sizeof(out_buf)) {
+		out_len += len;
+		return;
+	}
+
+	out_flush();
+	va_start(ap, fmt);
+	len = vsnprintf(out_buf, sizeof(out_buf), fmt, ap);
+	va_end(ap);
+	if (len > 0)
+		out_len = (size_t)len < sizeof(out_buf) ? (size_t)len : sizeof(out_buf) - 1;
+}
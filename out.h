@@ -0,0 +1,36 @@
+#ifndef EN_OUT_H_
+#define EN_OUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Buffered output for show commands.  Everything is formatted into one
+ * large buffer that is flushed to stdout with write(2), or writev(2) for
+ * large payloads, only when it fills up or on out_flush().
+ */
+#define OUT_BUFSZ	65536
+#define OUT_MACSZ	18		/* "xx:xx:xx:xx:xx:xx" and NUL */
+
+void  out_flush(void);
+void  out_capture(void);
+char *out_captured(size_t *len);
+
+void out_write(const void *data, size_t len);
+void out_str  (const char *str);
+void out_char (int ch);
+void out_pad  (int num);
+
+void out_u64  (uint64_t val);
+void out_s64  (int64_t val);
+void out_hex  (uint64_t val);
+
+void out_mac  (const unsigned char *mac);
+char *out_fmt_mac(char *buf, const unsigned char *mac);
+void out_ipv4 (const void *addr);
+void out_ipv6 (const void *addr);
+void out_addr (int family, const void *addr);
+
+void out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* EN_OUT_H_ */
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE		/* secure_getenv() */
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <link.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "en.h"
+#include "plugin.h"
+
+/*
+ * Plugins are only opened when one of their commands is used.  At start
+ * we read each module's manifest section straight from the ELF file and
+ * register its commands lazily, so a plain `en link` never pays for a
+ * dlopen() and a broken module only breaks its own commands.
+ */
+struct plugin {
+	struct plugin *next;
+	char          *path;
+	void          *handle;	/* NULL until loaded */
+};
+
+struct plugin_cmd {
+	struct plugin_cmd *next;
+	struct plugin     *plugin;
+	char              *name;	/* As in the manifest, e.g. "tunnel tun" */
+	char              *help;
+};
+
+static struct plugin     *plugins;
+static struct plugin_cmd *cmds;
+
+static void plugin_load(ArgParser *cmd)
+{
+	const char *name = ap_get_name(cmd);
+	int (*init)(ArgParser *, const char *);
+	struct plugin_cmd *pc;
+	struct plugin *p;
+
+	for (pc = cmds; pc; pc = pc->next) {
+		if (!strcmp(pc->name, name))
+			break;
+	}
+	if (!pc)
+		en_errx(1, "%s: no such plugin command", name);
+
+	p = pc->plugin;
+	if (!p->handle) {
+		p->handle = dlopen(p->path, RTLD_NOW | RTLD_LOCAL);
+		if (!p->handle)
+			en_errx(1, "%s", dlerror());
+	}
+
+	*(void **)&init = dlsym(p->handle, "en_plugin_init");
+	if (!init)
+		en_errx(1, "%s: missing en_plugin_init()", p->path);
+	if (init(cmd, name))
+		en_errx(1, "%s: failed initializing %s", p->path, name);
+}
+
+static int plugin_add(ArgParser *ap, struct plugin *p, const char *data, size_t len)
+{
+	const char *end = data + len;
+
+	while (data < end) {
+		const char *name = data, *help;
+		struct plugin_cmd *pc;
+
+		/* Sections from several objects are padded with NULs */
+		if (!*data) {
+			data++;
+			continue;
+		}
+
+		help = memchr(name, 0, end - name);
+		if (!help || ++help >= end || !memchr(help, 0, end - help))
+			return -1;
+		data = help + strlen(help) + 1;
+
+		/* Commands are looked up by name, the first one registered wins */
+		if (ap_cmd_exists(ap, (char *)name)) {
+			warnx("%s: command %s already exists, skipping", p->path, name);
+			continue;
+		}
+
+		pc = calloc(1, sizeof(*pc));
+		if (!pc || !(pc->name = strdup(name)) || !(pc->help = strdup(help)))
+			err(1, "Failed allocating plugin");
+		pc->plugin = p;
+		pc->next = cmds;
+		cmds = pc;
+
+		ap_add_cmd_lazy(ap, pc->name, pc->help, plugin_load, NULL);
+	}
+
+	return 0;
+}
+
+/* Find the manifest section, everything is bounds checked against @size */
+static int manifest(const unsigned char *map, size_t size, const char **data, size_t *len)
+{
+	const ElfW(Ehdr) *eh = (const void *)map;
+	const ElfW(Shdr) *sh, *str;
+	size_t i;
+
+	if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+	    eh->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32))
+		return -1;
+	if (eh->e_shentsize != sizeof(*sh) || eh->e_shoff > size ||
+	    eh->e_shnum > (size - eh->e_shoff) / sizeof(*sh) || eh->e_shstrndx >= eh->e_shnum)
+		return -1;
+
+	sh = (const void *)(map + eh->e_shoff);
+	str = &sh[eh->e_shstrndx];
+	if (str->sh_offset > size || str->sh_size > size - str->sh_offset ||
+	    str->sh_size < sizeof(EN_PLUGIN_SECTION))
+		return -1;
+
+	for (i = 0; i < eh->e_shnum; i++) {
+		const char *name = (const char *)map + str->sh_offset + sh[i].sh_name;
+
+		if (sh[i].sh_name > str->sh_size - sizeof(EN_PLUGIN_SECTION) ||
+		    memcmp(name, EN_PLUGIN_SECTION, sizeof(EN_PLUGIN_SECTION)))
+			continue;
+		if (sh[i].sh_type != SHT_PROGBITS || sh[i].sh_offset > size ||
+		    sh[i].sh_size > size - sh[i].sh_offset)
+			return -1;
+
+		*data = (const char *)map + sh[i].sh_offset;
+		*len = sh[i].sh_size;
+		return 0;
+	}
+
+	return -1;
+}
+
+static void plugin_scan(ArgParser *ap, const char *path)
+{
+	const char *data;
+	struct plugin *p;
+	struct stat st;
+	void *map;
+	size_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	if (manifest(map, st.st_size, &data, &len)) {
+		warnx("%s: no command manifest, skipping", path);
+		goto done;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p || !(p->path = strdup(path)))
+		err(1, "Failed allocating plugin");
+	p->next = plugins;
+	plugins = p;
+
+	if (plugin_add(ap, p, data, len))
+		warnx("%s: invalid command manifest", path);
+done:
+	munmap(map, st.st_size);
+}
+
+/* Register the commands of all modules in $EN_PLUGIN_DIR or EN_PLUGIN_DIR */
+int plugin_init(ArgParser *ap)
+{
+	const char *dir = secure_getenv("EN_PLUGIN_DIR");
+	struct dirent *d;
+	DIR *dp;
+
+	if (!dir)
+		dir = EN_PLUGIN_DIR;
+
+	dp = opendir(dir);
+	if (!dp)
+		return 0;
+
+	while ((d = readdir(dp))) {
+		char path[PATH_MAX];
+		size_t len = strlen(d->d_name);
+
+		if (len < 4 || strcmp(&d->d_name[len - 3], ".so"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+		plugin_scan(ap, path);
+	}
+	closedir(dp);
+
+	return 0;
+}
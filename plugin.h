@@ -0,0 +1,33 @@
+#ifndef EN_PLUGIN_H_
+#define EN_PLUGIN_H_
+
+#include "en.h"
+
+/*
+ * Command modules built as shared objects, installed in EN_PLUGIN_DIR.
+ * A module lists the top-level commands it provides with EN_PLUGIN_CMD(),
+ * en reads that list from the file without loading it.  The first time
+ * one of the commands is used the module is loaded and en_plugin_init()
+ * is called to register the subcommands and options of @cmd, with @name
+ * as given in the manifest.  Return non-zero on error.
+ *
+ *     EN_PLUGIN_CMD(tun, "tunnel tun", "Manage tunnels");
+ *
+ *     int en_plugin_init(ArgParser *cmd, const char *name)
+ *     {
+ *             ap_add_cmd(cmd, "show", "Show tunnels", tun_show);
+ *             return 0;
+ *     }
+ *
+ * Build with: cc -shared -fPIC -o tun.so tun.c
+ */
+#define EN_PLUGIN_SECTION	"en_manifest"
+
+#define EN_PLUGIN_CMD(id, name, help)					\
+	static const char en_manifest_##id[]				\
+	__attribute__((section(EN_PLUGIN_SECTION), used, aligned(1))) =	\
+		name "\0" help
+
+int en_plugin_init(ArgParser *cmd, const char *name);
+
+#endif /* EN_PLUGIN_H_ */
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+
+	size_t          njobs;
+	size_t          next;		/* Next job to hand out */
+	bool           *finished;
+
+	pool_job_t      job;
+	void           *arg;
+};
+
+static void *pool_worker(void *data)
+{
+	struct pool *pool = data;
+
+	while (1) {
+		size_t idx;
+
+		pthread_mutex_lock(&pool->lock);
+		idx = pool->next < pool->njobs ? pool->next++ : pool->njobs;
+		pthread_mutex_unlock(&pool->lock);
+		if (idx == pool->njobs)
+			break;
+
+		pool->job(idx, pool->arg);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->finished[idx] = true;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run @njobs jobs on up to @nworkers threads.  As soon as a job and all
+ * before it are finished, @done is called for it in the caller's thread,
+ * so results can be streamed out in order while later jobs still run.
+ * Jobs never run in the caller's thread, they may change per-thread
+ * state such as the network namespace, so it fails if no thread starts.
+ * Returns -1 with errno set on error.
+ */
+int pool_run(size_t njobs, int nworkers, pool_job_t job, pool_job_t done, void *arg)
+{
+	struct pool pool = {
+		.lock  = PTHREAD_MUTEX_INITIALIZER,
+		.cond  = PTHREAD_COND_INITIALIZER,
+		.njobs = njobs,
+		.job   = job,
+		.arg   = arg,
+	};
+	pthread_t *tids;
+	int i, rc = 0, num = 0;
+	size_t idx;
+
+	if ((size_t)nworkers > njobs)
+		nworkers = njobs;
+
+	pool.finished = calloc(njobs ? njobs : 1, sizeof(bool));
+	tids = calloc(nworkers > 0 ? nworkers : 1, sizeof(pthread_t));
+	if (!pool.finished || !tids) {
+		free(pool.finished);
+		free(tids);
+		return -1;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		rc = pthread_create(&tids[num], NULL, pool_worker, &pool);
+		if (rc)
+			break;
+		num++;
+	}
+	if (!num && njobs) {
+		free(pool.finished);
+		free(tids);
+		errno = rc;
+		return -1;
+	}
+
+	for (idx = 0; idx < njobs; idx++) {
+		pthread_mutex_lock(&pool.lock);
+		while (!pool.finished[idx])
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (done)
+			done(idx, arg);
+	}
+
+	for (i = 0; i < num; i++)
+		pthread_join(tids[i], NULL);
+
+	free(pool.finished);
+	free(tids);
+
+	return 0;
+}
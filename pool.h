@@ -0,0 +1,11 @@
+#ifndef EN_POOL_H_
+#define EN_POOL_H_
+
+#include <stddef.h>
+
+/* Called from a worker thread, and in job order from the caller's thread */
+typedef void (*pool_job_t)(size_t idx, void *arg);
+
+int pool_run(size_t njobs, int nworkers, pool_job_t job, pool_job_t done, void *arg);
+
+#endif /* EN_POOL_H_ */
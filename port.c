@@ -0,0 +1,849 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/ethtool.h>
+#include <linux/ethtool_netlink.h>
+#include <linux/sockios.h>
+#include <net/if_arp.h>
+
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+#include "pool.h"
+
+#define PORT_WORKERS	16
+#define PORT_NWORDS	127		/* Max link mode mask words, s8 in the ABI */
+
+/* Indexed by ETHTOOL_LINK_MODE_*_BIT */
+static const char *link_modes[] = {
+	"10baseT/Half", "10baseT/Full", "100baseT/Half", "100baseT/Full",
+	"1000baseT/Half", "1000baseT/Full", "Autoneg", "TP", "AUI", "MII",
+	"FIBRE", "BNC", "10000baseT/Full", "Pause", "Asym_Pause",
+	"2500baseX/Full", "Backplane", "1000baseKX/Full", "10000baseKX4/Full",
+	"10000baseKR/Full", "10000baseR_FEC", "20000baseMLD2/Full",
+	"20000baseKR2/Full", "40000baseKR4/Full", "40000baseCR4/Full",
+	"40000baseSR4/Full", "40000baseLR4/Full", "56000baseKR4/Full",
+	"56000baseCR4/Full", "56000baseSR4/Full", "56000baseLR4/Full",
+	"25000baseCR/Full", "25000baseKR/Full", "25000baseSR/Full",
+	"50000baseCR2/Full", "50000baseKR2/Full", "100000baseKR4/Full",
+	"100000baseSR4/Full", "100000baseCR4/Full", "100000baseLR4_ER4/Full",
+	"50000baseSR2/Full", "1000baseX/Full", "10000baseCR/Full",
+	"10000baseSR/Full", "10000baseLR/Full", "10000baseLRM/Full",
+	"10000baseER/Full", "2500baseT/Full", "5000baseT/Full", "FEC_NONE",
+	"FEC_RS", "FEC_BASER", "50000baseKR/Full", "50000baseSR/Full",
+	"50000baseCR/Full", "50000baseLR_ER_FR/Full", "50000baseDR/Full",
+	"100000baseKR2/Full", "100000baseSR2/Full", "100000baseCR2/Full",
+	"100000baseLR2_ER2_FR2/Full", "100000baseDR2/Full",
+	"200000baseKR4/Full", "200000baseSR4/Full",
+	"200000baseLR4_ER4_FR4/Full", "200000baseDR4/Full",
+	"200000baseCR4/Full", "100baseT1/Full", "1000baseT1/Full",
+	"400000baseKR8/Full", "400000baseSR8/Full",
+	"400000baseLR8_ER8_FR8/Full", "400000baseDR8/Full",
+	"400000baseCR8/Full", "FEC_LLRS", "100000baseKR/Full",
+	"100000baseSR/Full", "100000baseLR_ER_FR/Full", "100000baseCR/Full",
+	"100000baseDR/Full", "200000baseKR2/Full", "200000baseSR2/Full",
+	"200000baseLR2_ER2_FR2/Full", "200000baseDR2/Full",
+	"200000baseCR2/Full", "400000baseKR4/Full", "400000baseSR4/Full",
+	"400000baseLR4_ER4_FR4/Full", "400000baseDR4/Full",
+	"400000baseCR4/Full", "100baseFX/Half", "100baseFX/Full",
+	"10baseT1L/Full",
+};
+
+static const struct {
+	unsigned int type;
+	const char  *name;
+} module_types[] = {
+	{ ETH_MODULE_SFF_8079, "SFF-8079" },
+	{ ETH_MODULE_SFF_8472, "SFF-8472" },
+	{ ETH_MODULE_SFF_8636, "SFF-8636" },
+	{ ETH_MODULE_SFF_8436, "SFF-8436" },
+};
+
+static const struct {
+	unsigned int port;
+	const char  *name;
+} port_types[] = {
+	{ PORT_TP,    "TP"    },
+	{ PORT_AUI,   "AUI"   },
+	{ PORT_BNC,   "BNC"   },
+	{ PORT_MII,   "MII"   },
+	{ PORT_FIBRE, "FIBRE" },
+	{ PORT_DA,    "DA"    },
+	{ PORT_NONE,  "none"  },
+	{ PORT_OTHER, "other" },
+};
+
+/* Everything we learn about a port, filled in by a worker */
+struct port {
+	char                      name[IF_NAMESIZE];
+
+	bool                      has_drv;
+	struct ethtool_drvinfo    drv;
+
+	bool                      has_link;
+	struct ethtool_value      link;
+
+	bool                      has_settings;
+	struct {
+		struct ethtool_link_settings req;
+		uint32_t                     maps[3 * PORT_NWORDS];
+	} settings;
+
+	bool                      has_module;
+	struct ethtool_modinfo    module;
+};
+
+/*
+ * Stat names from an ethtool string set, kept for as long as we run.  A
+ * driver's ETH_SS_STATS set is the same for all its ports with the same
+ * number of stats, so it is fetched once per driver.  Global sets, like
+ * the names of the standard stats groups, have an empty driver.
+ */
+struct strset {
+	struct strset *next;
+	char           driver[32];
+	unsigned int   id;
+	unsigned int   count;
+	char         (*names)[ETH_GSTRING_LEN];
+};
+
+static struct strset   *strsets;
+static pthread_mutex_t  strsets_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              ethtool_id;	/* Generic netlink family */
+
+/* Indexed by ETHTOOL_STATS_*, same names as ETH_SS_STATS_STD */
+static const char *stats_groups[] = {
+	"eth-phy", "eth-mac", "eth-ctrl", "rmon",
+};
+
+struct port_run {
+	int            sd;
+	struct port   *ports;
+	size_t         num;
+	bool           json;
+	struct filter *flt;
+};
+
+enum {
+	PF_IFNAME, PF_DRIVER, PF_LINK, PF_SPEED, PF_DUPLEX, PF_AUTONEG, PF_PORT,
+};
+
+static const struct filter_field port_fields[] = {
+	{ "ifname",  PF_IFNAME,  FILTER_STR },
+	{ "driver",  PF_DRIVER,  FILTER_STR },
+	{ "link",    PF_LINK,    FILTER_NUM },
+	{ "speed",   PF_SPEED,   FILTER_NUM },
+	{ "duplex",  PF_DUPLEX,  FILTER_STR },
+	{ "autoneg", PF_AUTONEG, FILTER_NUM },
+	{ "port",    PF_PORT,    FILTER_STR },
+};
+
+static int port_ioctl(int sd, const char *name, void *cmd)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+	ifr.ifr_data = cmd;
+
+	return ioctl(sd, SIOCETHTOOL, &ifr);
+}
+
+/*
+ * Link settings take two calls, the first one with zero mask words, to
+ * which the kernel answers with the negated number it wants.
+ */
+static bool port_settings(int sd, struct port *p)
+{
+	struct ethtool_link_settings *req = &p->settings.req;
+	int nwords;
+
+	req->cmd = ETHTOOL_GLINKSETTINGS;
+	if (port_ioctl(sd, p->name, req) || req->link_mode_masks_nwords >= 0)
+		return false;
+
+	nwords = -req->link_mode_masks_nwords;
+	if (nwords > PORT_NWORDS)
+		return false;
+
+	memset(&p->settings, 0, sizeof(p->settings));
+	req->cmd = ETHTOOL_GLINKSETTINGS;
+	req->link_mode_masks_nwords = nwords;
+
+	return !port_ioctl(sd, p->name, req) && req->link_mode_masks_nwords == nwords;
+}
+
+/* Runs in a worker, each ioctl may take long with slow PHY drivers */
+static void port_job(size_t idx, void *arg)
+{
+	struct port_run *run = arg;
+	struct port *p = &run->ports[idx];
+
+	p->drv.cmd = ETHTOOL_GDRVINFO;
+	p->has_drv = !port_ioctl(run->sd, p->name, &p->drv);
+
+	p->link.cmd = ETHTOOL_GLINK;
+	p->has_link = !port_ioctl(run->sd, p->name, &p->link);
+
+	p->has_settings = port_settings(run->sd, p);
+
+	p->module.cmd = ETHTOOL_GMODULEINFO;
+	p->has_module = !port_ioctl(run->sd, p->name, &p->module);
+}
+
+static const char *port_type(unsigned int port)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(port_types); i++) {
+		if (port_types[i].port == port)
+			return port_types[i].name;
+	}
+
+	return "unknown";
+}
+
+static const char *module_type(unsigned int type)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(module_types); i++) {
+		if (module_types[i].type == type)
+			return module_types[i].name;
+	}
+
+	return "unknown";
+}
+
+static const char *duplex(unsigned int duplex)
+{
+	if (duplex == DUPLEX_FULL)
+		return "full";
+	if (duplex == DUPLEX_HALF)
+		return "half";
+
+	return "unknown";
+}
+
+static void port_field(void *rec, int id, struct filter_val *val)
+{
+	struct port *p = rec;
+	struct ethtool_link_settings *s = &p->settings.req;
+
+	switch (id) {
+	case PF_IFNAME:
+		val->str = p->name;
+		break;
+	case PF_DRIVER:
+		if (p->has_drv)
+			val->str = p->drv.driver;
+		break;
+	case PF_LINK:
+		if (p->has_link)
+			val->num = !!p->link.data;
+		break;
+	case PF_SPEED:
+		if (p->has_settings && s->speed != (uint32_t)SPEED_UNKNOWN)
+			val->num = s->speed;
+		break;
+	case PF_DUPLEX:
+		if (p->has_settings)
+			val->str = duplex(s->duplex);
+		break;
+	case PF_AUTONEG:
+		if (p->has_settings)
+			val->num = s->autoneg == AUTONEG_ENABLE;
+		break;
+	case PF_PORT:
+		if (p->has_settings)
+			val->str = port_type(s->port);
+		break;
+	}
+}
+
+/* Link mode mask @n, 0 supported, 1 advertised, 2 link partner */
+static void port_modes_text(struct port *p, const char *title, int n)
+{
+	int nwords = p->settings.req.link_mode_masks_nwords;
+	const uint32_t *map = &p->settings.maps[n * nwords];
+	int bit, num = 0;
+
+	for (bit = 0; bit < 32 * nwords; bit++) {
+		if (!(map[bit / 32] & (1U << (bit % 32))))
+			continue;
+
+		if (!num++) {
+			out_str("    ");
+			out_str(title);
+			out_char(':');
+		}
+		out_char(' ');
+		if ((size_t)bit < NELEMS(link_modes))
+			out_str(link_modes[bit]);
+		else
+			out_printf("bit%d", bit);
+	}
+	if (num)
+		out_char('\n');
+}
+
+static void port_modes_json(struct port *p, const char *key, int n)
+{
+	int nwords = p->settings.req.link_mode_masks_nwords;
+	const uint32_t *map = &p->settings.maps[n * nwords];
+	char buf[16];
+	int bit;
+
+	json_begin_array(key);
+	for (bit = 0; bit < 32 * nwords; bit++) {
+		if (!(map[bit / 32] & (1U << (bit % 32))))
+			continue;
+
+		if ((size_t)bit < NELEMS(link_modes))
+			json_string(NULL, link_modes[bit]);
+		else {
+			snprintf(buf, sizeof(buf), "bit%d", bit);
+			json_string(NULL, buf);
+		}
+	}
+	json_end_array();
+}
+
+static void port_show_text(struct port *p)
+{
+	struct ethtool_link_settings *s = &p->settings.req;
+
+	out_str(p->name);
+	out_str(":\n");
+
+	if (p->has_drv) {
+		out_str("    driver ");
+		out_str(p->drv.driver);
+		if (p->drv.version[0]) {
+			out_str(" version ");
+			out_str(p->drv.version);
+		}
+		if (p->drv.fw_version[0]) {
+			out_str(" firmware ");
+			out_str(p->drv.fw_version);
+		}
+		if (p->drv.bus_info[0]) {
+			out_str(" bus ");
+			out_str(p->drv.bus_info);
+		}
+		out_char('\n');
+	}
+
+	if (p->has_link || p->has_settings) {
+		out_str("    link");
+		if (p->has_link)
+			out_str(p->link.data ? " up" : " down");
+		if (p->has_settings) {
+			out_str(" speed ");
+			if (s->speed == (uint32_t)SPEED_UNKNOWN)
+				out_str("unknown");
+			else {
+				out_u64(s->speed);
+				out_str("Mb/s");
+			}
+			out_str(" duplex ");
+			out_str(duplex(s->duplex));
+			out_str(" autoneg ");
+			out_str(s->autoneg == AUTONEG_ENABLE ? "on" : "off");
+			out_str(" port ");
+			out_str(port_type(s->port));
+		}
+		out_char('\n');
+	}
+
+	if (p->has_settings) {
+		port_modes_text(p, "supported", 0);
+		port_modes_text(p, "advertised", 1);
+		port_modes_text(p, "partner", 2);
+	}
+
+	if (p->has_module) {
+		out_str("    module ");
+		out_str(module_type(p->module.type));
+		out_str(" eeprom ");
+		out_u64(p->module.eeprom_len);
+		out_char('\n');
+	}
+}
+
+static void port_show_json(struct port *p)
+{
+	struct ethtool_link_settings *s = &p->settings.req;
+
+	json_begin_object(NULL);
+	json_string("ifname", p->name);
+
+	if (p->has_drv) {
+		json_string("driver", p->drv.driver);
+		if (p->drv.version[0])
+			json_string("version", p->drv.version);
+		if (p->drv.fw_version[0])
+			json_string("firmware", p->drv.fw_version);
+		if (p->drv.bus_info[0])
+			json_string("bus", p->drv.bus_info);
+	}
+	if (p->has_link)
+		json_bool("link", p->link.data);
+
+	if (p->has_settings) {
+		if (s->speed == (uint32_t)SPEED_UNKNOWN)
+			json_null("speed");
+		else
+			json_uint("speed", s->speed);
+		json_string("duplex", duplex(s->duplex));
+		json_bool("autoneg", s->autoneg == AUTONEG_ENABLE);
+		json_string("port", port_type(s->port));
+		port_modes_json(p, "supported", 0);
+		port_modes_json(p, "advertised", 1);
+		port_modes_json(p, "partner", 2);
+	}
+
+	if (p->has_module) {
+		json_begin_object("module");
+		json_string("type", module_type(p->module.type));
+		json_uint("eeprom", p->module.eeprom_len);
+		json_end_object();
+	}
+
+	json_end_object();
+}
+
+/* Called in port order as soon as a port and all before it are done */
+static void port_done(size_t idx, void *arg)
+{
+	struct port_run *run = arg;
+
+	if (!filter_match(run->flt, port_field, &run->ports[idx]))
+		return;
+
+	if (run->json)
+		port_show_json(&run->ports[idx]);
+	else
+		port_show_text(&run->ports[idx]);
+}
+
+static void port_add(struct port_run *run, size_t *max, const char *name)
+{
+	if (run->num == *max) {
+		struct port *ports;
+
+		*max = *max ? *max * 2 : 64;
+		ports = realloc(run->ports, *max * sizeof(*ports));
+		if (!ports) {
+			free(run->ports);
+			en_err(1, "Failed allocating ports");
+		}
+		run->ports = ports;
+	}
+
+	memset(&run->ports[run->num], 0, sizeof(run->ports[0]));
+	snprintf(run->ports[run->num].name, sizeof(run->ports[0].name), "%s", name);
+	run->num++;
+}
+
+/*
+ * Per port data only comes from ethtool, one or more slow ioctls per
+ * port.  Fan them out over a pool of workers, sharing one socket, and
+ * show the results in port order.
+ */
+static void port_show(ArgParser *ap)
+{
+	struct port_run run = {
+		.json = en_json(),
+		.flt  = en_filter(port_fields, NELEMS(port_fields)),
+	};
+	int i, argc = ap_len_args(ap);
+	size_t max = 0;
+
+	for (i = 0; i < argc; i++)
+		en_ifindex(ap_get_arg(ap, i));
+
+	if (argc) {
+		for (i = 0; i < argc; i++)
+			port_add(&run, &max, ap_get_arg(ap, i));
+	} else {
+		const struct iface *iface;
+
+		for (iface = iface_next(0); iface; iface = iface_next(iface->ifindex)) {
+			if (iface->type == ARPHRD_ETHER)
+				port_add(&run, &max, iface->name);
+		}
+	}
+
+	run.sd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (run.sd < 0) {
+		free(run.ports);
+		en_err(1, "socket");
+	}
+
+	if (run.json)
+		json_begin_array(NULL);
+	if (pool_run(run.num, PORT_WORKERS, port_job, port_done, &run)) {
+		close(run.sd);
+		free(run.ports);
+		en_err(1, "Failed querying ports");
+	}
+	if (run.json)
+		json_end_array();
+
+	close(run.sd);
+	free(run.ports);
+}
+
+/* Generic netlink request to the ethtool family */
+struct ethnl_req {
+	struct nlmsghdr   nh;
+	struct genlmsghdr genl;
+	char              attr[256];
+};
+
+static int ethnl_family(void)
+{
+	if (!ethtool_id)
+		ethtool_id = nl_genl_family(en_genl(), ETHTOOL_GENL_NAME);
+	if (ethtool_id < 0)
+		en_errx(1, "ethtool netlink not supported by kernel");
+
+	return ethtool_id;
+}
+
+static void ethnl_init(struct ethnl_req *req, int cmd, int hdr, const char *ifname)
+{
+	struct rtattr *nest;
+
+	memset(req, 0, sizeof(*req));
+	req->nh.nlmsg_len   = NLMSG_LENGTH(GENL_HDRLEN);
+	req->nh.nlmsg_type  = ethnl_family();
+	req->nh.nlmsg_flags = NLM_F_REQUEST;
+	req->genl.cmd       = cmd;
+	req->genl.version   = ETHTOOL_GENL_VERSION;
+
+	nest = nl_attr_nest(&req->nh, sizeof(*req), hdr);
+	if (ifname)
+		nl_attr_put_str(&req->nh, sizeof(*req), ETHTOOL_A_HEADER_DEV_NAME, ifname);
+	nl_attr_nest_end(&req->nh, nest);
+}
+
+static struct rtattr *ethnl_attrs(struct nlmsghdr *nlh, int *len)
+{
+	*len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	return (struct rtattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+}
+
+#define rta_for_each(rta, nest, len)					\
+	for (len = RTA_PAYLOAD(nest), rta = RTA_DATA(nest);		\
+	     RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+
+static int strset_parse(struct nlmsghdr *nlh, void *arg)
+{
+	struct rtattr *tb[ETHTOOL_A_STRSET_MAX + 1], *ss[ETHTOOL_A_STRINGSET_MAX + 1];
+	struct rtattr *str[ETHTOOL_A_STRING_MAX + 1], *set, *rta;
+	struct strset *s = arg;
+	int len;
+	struct rtattr *attrs = ethnl_attrs(nlh, &len);
+
+	nl_attr_parse(tb, ETHTOOL_A_STRSET_MAX, attrs, len);
+	if (!tb[ETHTOOL_A_STRSET_STRINGSETS])
+		return 0;
+
+	rta_for_each(set, tb[ETHTOOL_A_STRSET_STRINGSETS], len) {
+		int num;
+
+		nl_attr_parse(ss, ETHTOOL_A_STRINGSET_MAX, RTA_DATA(set), RTA_PAYLOAD(set));
+		if (!ss[ETHTOOL_A_STRINGSET_ID] || nl_attr_u32(ss[ETHTOOL_A_STRINGSET_ID]) != s->id ||
+		    !ss[ETHTOOL_A_STRINGSET_COUNT])
+			continue;
+
+		s->count = nl_attr_u32(ss[ETHTOOL_A_STRINGSET_COUNT]);
+		s->names = calloc(s->count ? s->count : 1, sizeof(s->names[0]));
+		if (!s->names)
+			return -1;
+		if (!ss[ETHTOOL_A_STRINGSET_STRINGS])
+			continue;
+
+		rta_for_each(rta, ss[ETHTOOL_A_STRINGSET_STRINGS], num) {
+			unsigned int idx;
+
+			nl_attr_parse(str, ETHTOOL_A_STRING_MAX, RTA_DATA(rta), RTA_PAYLOAD(rta));
+			if (!str[ETHTOOL_A_STRING_INDEX] || !str[ETHTOOL_A_STRING_VALUE])
+				continue;
+
+			idx = nl_attr_u32(str[ETHTOOL_A_STRING_INDEX]);
+			if (idx < s->count)
+				snprintf(s->names[idx], sizeof(s->names[idx]), "%s",
+					 nl_attr_str(str[ETHTOOL_A_STRING_VALUE]));
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Look up string set @id in the cache, fetch it on a miss.  For driver
+ * stats @ifname is the port we ask about and @count what the driver told
+ * us, a driver that changes its number of stats gets a new entry.
+ * Everything that can en_err() is done before taking the lock and
+ * allocating the entry, neither must be left behind by a longjmp.
+ */
+static const struct strset *strset_get(const char *driver, unsigned int id,
+				       unsigned int count, const char *ifname)
+{
+	struct ethnl_req req;
+	struct rtattr *sets, *set;
+	struct strset *s;
+	struct nl *nl;
+
+	nl = en_genl();
+	ethnl_init(&req, ETHTOOL_MSG_STRSET_GET, ETHTOOL_A_STRSET_HEADER, ifname);
+	sets = nl_attr_nest(&req.nh, sizeof(req), ETHTOOL_A_STRSET_STRINGSETS);
+	set = nl_attr_nest(&req.nh, sizeof(req), ETHTOOL_A_STRINGSETS_STRINGSET);
+	nl_attr_put_u32(&req.nh, sizeof(req), ETHTOOL_A_STRINGSET_ID, id);
+	nl_attr_nest_end(&req.nh, set);
+	nl_attr_nest_end(&req.nh, sets);
+
+	pthread_mutex_lock(&strsets_lock);
+	for (s = strsets; s; s = s->next) {
+		if (s->id == id && !strcmp(s->driver, driver) && (!ifname || s->count == count))
+			goto done;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		goto done;
+	snprintf(s->driver, sizeof(s->driver), "%s", driver);
+	s->id = id;
+
+	if (nl_query(nl, &req.nh, strset_parse, s) || !s->names ||
+	    (ifname && s->count != count)) {
+		free(s->names);
+		free(s);
+		s = NULL;
+		goto done;
+	}
+
+	s->next = strsets;
+	strsets = s;
+done:
+	pthread_mutex_unlock(&strsets_lock);
+
+	return s;
+}
+
+static const char *strset_name(const struct strset *s, unsigned int idx)
+{
+	static __thread char buf[16];
+
+	if (s && idx < s->count && s->names[idx][0])
+		return s->names[idx];
+
+	snprintf(buf, sizeof(buf), "stat%u", idx);
+	return buf;
+}
+
+static void stat_show(bool json, const char *name, uint64_t val)
+{
+	if (json) {
+		json_uint(name, val);
+		return;
+	}
+
+	out_str("        ");
+	out_str(name);
+	out_str(": ");
+	out_u64(val);
+	out_char('\n');
+}
+
+static void group_begin(bool json, const char *name)
+{
+	if (json)
+		json_begin_object(name);
+	else {
+		out_str("    ");
+		out_str(name);
+		out_str(":\n");
+	}
+}
+
+static void group_end(bool json)
+{
+	if (json)
+		json_end_object();
+}
+
+/* One ETHTOOL_A_STATS_GRP, each stat is a nest with the index as type */
+static void stats_group(bool json, struct rtattr *grp)
+{
+	struct rtattr *tb[ETHTOOL_A_STATS_GRP_MAX + 1], *rta;
+	const struct strset *names;
+	unsigned int id, num = 0;
+	char group[16];
+	int len;
+
+	nl_attr_parse(tb, ETHTOOL_A_STATS_GRP_MAX, RTA_DATA(grp), RTA_PAYLOAD(grp));
+	if (!tb[ETHTOOL_A_STATS_GRP_ID] || !tb[ETHTOOL_A_STATS_GRP_SS_ID])
+		return;
+
+	id = nl_attr_u32(tb[ETHTOOL_A_STATS_GRP_ID]);
+	names = strset_get("", nl_attr_u32(tb[ETHTOOL_A_STATS_GRP_SS_ID]), 0, NULL);
+	if (id < NELEMS(stats_groups))
+		snprintf(group, sizeof(group), "%s", stats_groups[id]);
+	else
+		snprintf(group, sizeof(group), "group%u", id);
+
+	/* The kernel includes groups the driver has nothing for */
+	rta_for_each(rta, grp, len) {
+		struct rtattr *stat;
+
+		if ((rta->rta_type & NLA_TYPE_MASK) != ETHTOOL_A_STATS_GRP_STAT)
+			continue;
+
+		stat = RTA_DATA(rta);
+		if (!RTA_OK(stat, (int)RTA_PAYLOAD(rta)) || RTA_PAYLOAD(stat) != sizeof(uint64_t))
+			continue;
+
+		if (!num++)
+			group_begin(json, group);
+		stat_show(json, strset_name(names, stat->rta_type & NLA_TYPE_MASK),
+			  *(uint64_t *)RTA_DATA(stat));
+	}
+
+	if (num)
+		group_end(json);
+}
+
+static int stats_parse(struct nlmsghdr *nlh, void *arg)
+{
+	struct rtattr *rta;
+	bool *json = arg;
+	int len;
+
+	for (rta = ethnl_attrs(nlh, &len); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if ((rta->rta_type & NLA_TYPE_MASK) == ETHTOOL_A_STATS_GRP)
+			stats_group(*json, rta);
+	}
+
+	return 0;
+}
+
+/* Standard IEEE 802.3 and RMON groups, few drivers have them */
+static int port_stats_std(const char *ifname, bool json)
+{
+	uint32_t groups = (1U << __ETHTOOL_STATS_CNT) - 1;
+	struct rtattr *bitset;
+	struct ethnl_req req;
+
+	ethnl_init(&req, ETHTOOL_MSG_STATS_GET, ETHTOOL_A_STATS_HEADER, ifname);
+	bitset = nl_attr_nest(&req.nh, sizeof(req), ETHTOOL_A_STATS_GROUPS);
+	nl_attr_put(&req.nh, sizeof(req), ETHTOOL_A_BITSET_NOMASK, NULL, 0);
+	nl_attr_put_u32(&req.nh, sizeof(req), ETHTOOL_A_BITSET_SIZE, __ETHTOOL_STATS_CNT);
+	nl_attr_put(&req.nh, sizeof(req), ETHTOOL_A_BITSET_VALUE, &groups, sizeof(groups));
+	nl_attr_nest_end(&req.nh, bitset);
+
+	if (nl_query(en_genl(), &req.nh, stats_parse, &json) && errno != EOPNOTSUPP)
+		return -1;
+
+	return 0;
+}
+
+/* Driver specific stats, the values only come with the ioctl */
+static int port_stats_drv(int sd, const char *ifname, bool json)
+{
+	struct ethtool_drvinfo drv = { .cmd = ETHTOOL_GDRVINFO };
+	const struct strset *names;
+	struct ethtool_stats *st;
+	unsigned int i;
+
+	if (port_ioctl(sd, ifname, &drv) || !drv.n_stats)
+		return 0;
+
+	names = strset_get(drv.driver, ETH_SS_STATS, drv.n_stats, ifname);
+
+	st = calloc(1, sizeof(*st) + drv.n_stats * sizeof(uint64_t));
+	if (!st)
+		return -1;
+	st->cmd = ETHTOOL_GSTATS;
+	st->n_stats = drv.n_stats;
+	if (port_ioctl(sd, ifname, st)) {
+		free(st);
+		return 0;
+	}
+
+	group_begin(json, "driver");
+	for (i = 0; i < st->n_stats && i < drv.n_stats; i++)
+		stat_show(json, strset_name(names, i), st->data[i]);
+	group_end(json);
+
+	free(st);
+
+	return 0;
+}
+
+/*
+ * Port counters, the driver's own and the standard groups.  Stat names
+ * are string sets, looked up once and kept, so repeated polling of many
+ * ports of the same kind is only the counter reads.
+ */
+static void port_stats(ArgParser *ap)
+{
+	bool json = en_json();
+	int i, sd, argc = ap_len_args(ap);
+
+	if (!argc)
+		en_errx(1, "missing interface");
+	for (i = 0; i < argc; i++)
+		en_ifindex(ap_get_arg(ap, i));
+
+	sd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		en_err(1, "socket");
+
+	if (json)
+		json_begin_array(NULL);
+	for (i = 0; i < argc; i++) {
+		const char *ifname = ap_get_arg(ap, i);
+
+		if (json) {
+			json_begin_object(NULL);
+			json_string("ifname", ifname);
+		} else {
+			out_str(ifname);
+			out_str(":\n");
+		}
+
+		if (port_stats_drv(sd, ifname, json) || port_stats_std(ifname, json)) {
+			close(sd);
+			en_err(1, "%s: failed reading stats", ifname);
+		}
+
+		if (json)
+			json_end_object();
+	}
+	if (json)
+		json_end_array();
+
+	close(sd);
+}
+
+static void port_cmds(ArgParser *port)
+{
+	filter_cmd(ap_add_cmd(port, "show list", "Show ports: [IFNAME]...", port_show));
+	ap_add_cmd(port, "stats statistics", "Show port counters: IFNAME...", port_stats);
+}
+
+int port_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "port", "Ethernet port, PHY and module information", port_cmds, NULL);
+
+	return 0;
+}
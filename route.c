@@ -0,0 +1,578 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "en.h"
+#include "filter.h"
+#include "out.h"
+
+enum {
+	PFX_NONE,
+	PFX_EXACT,
+	PFX_ROOT,
+	PFX_MATCH,
+};
+
+struct route_filter {
+	bool            json;
+	uint32_t        table;
+	int             proto;
+	int             mode;
+	struct prefix   pfx;
+	struct filter  *flt;
+
+	/* Route being filtered */
+	struct rtmsg   *rtm;
+	uint32_t        rt_table;
+	struct rtattr **tb;
+};
+
+enum {
+	RF_DST, RF_DSTLEN, RF_GATEWAY, RF_DEV, RF_TABLE, RF_PROTO,
+	RF_SCOPE, RF_TYPE, RF_PREFSRC, RF_METRIC,
+};
+
+static const struct filter_field route_fields[] = {
+	{ "dst",      RF_DST,     FILTER_STR },
+	{ "dstlen",   RF_DSTLEN,  FILTER_NUM },
+	{ "gateway",  RF_GATEWAY, FILTER_STR },
+	{ "dev",      RF_DEV,     FILTER_STR },
+	{ "table",    RF_TABLE,   FILTER_STR },
+	{ "proto",    RF_PROTO,   FILTER_STR },
+	{ "protocol", RF_PROTO,   FILTER_STR },
+	{ "scope",    RF_SCOPE,   FILTER_STR },
+	{ "type",     RF_TYPE,    FILTER_STR },
+	{ "prefsrc",  RF_PREFSRC, FILTER_STR },
+	{ "metric",   RF_METRIC,  FILTER_NUM },
+};
+
+struct name {
+	unsigned int id;
+	const char  *name;
+};
+
+static const struct name tables[] = {
+	{ RT_TABLE_UNSPEC,  "all"     },
+	{ RT_TABLE_DEFAULT, "default" },
+	{ RT_TABLE_MAIN,    "main"    },
+	{ RT_TABLE_LOCAL,   "local"   },
+};
+
+static const struct name protos[] = {
+	{ RTPROT_REDIRECT,   "redirect"   },
+	{ RTPROT_KERNEL,     "kernel"     },
+	{ RTPROT_BOOT,       "boot"       },
+	{ RTPROT_STATIC,     "static"     },
+	{ RTPROT_RA,         "ra"         },
+	{ RTPROT_DHCP,       "dhcp"       },
+	{ RTPROT_KEEPALIVED, "keepalived" },
+	{ RTPROT_ZEBRA,      "zebra"      },
+	{ RTPROT_BIRD,       "bird"       },
+	{ RTPROT_BABEL,      "babel"      },
+	{ RTPROT_BGP,        "bgp"        },
+	{ RTPROT_ISIS,       "isis"       },
+	{ RTPROT_OSPF,       "ospf"       },
+	{ RTPROT_RIP,        "rip"        },
+	{ RTPROT_EIGRP,      "eigrp"      },
+};
+
+static const struct name scopes[] = {
+	{ RT_SCOPE_UNIVERSE, "global"  },
+	{ RT_SCOPE_SITE,     "site"    },
+	{ RT_SCOPE_LINK,     "link"    },
+	{ RT_SCOPE_HOST,     "host"    },
+	{ RT_SCOPE_NOWHERE,  "nowhere" },
+};
+
+static const struct name types[] = {
+	{ RTN_UNICAST,     "unicast"     },
+	{ RTN_LOCAL,       "local"       },
+	{ RTN_BROADCAST,   "broadcast"   },
+	{ RTN_ANYCAST,     "anycast"     },
+	{ RTN_MULTICAST,   "multicast"   },
+	{ RTN_BLACKHOLE,   "blackhole"   },
+	{ RTN_UNREACHABLE, "unreachable" },
+	{ RTN_PROHIBIT,    "prohibit"    },
+	{ RTN_THROW,       "throw"       },
+	{ RTN_NAT,         "nat"         },
+};
+
+static const char *id2name(const struct name *tbl, size_t len, unsigned int id, char *buf)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (tbl[i].id == id)
+			return tbl[i].name;
+	}
+
+	/* Unnamed, render the number */
+	i = 11;
+	buf[i] = 0;
+	do {
+		buf[--i] = '0' + id % 10;
+		id /= 10;
+	} while (id);
+
+	return &buf[i];
+}
+
+static unsigned int name2id(const struct name *tbl, size_t len, const char *name, const char *what)
+{
+	unsigned long id;
+	char *end;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (!strcmp(tbl[i].name, name))
+			return tbl[i].id;
+	}
+
+	id = strtoul(name, &end, 0);
+	if (*name == 0 || *end != 0 || id > UINT32_MAX)
+		en_errx(1, "invalid %s '%s'", what, name);
+
+	return id;
+}
+
+/* Compare the first @bits of two addresses */
+static bool bits_match(const unsigned char *a, const unsigned char *b, int bits)
+{
+	int bytes = bits / 8;
+
+	if (memcmp(a, b, bytes))
+		return false;
+
+	bits %= 8;
+	if (!bits)
+		return true;
+
+	return !((a[bytes] ^ b[bytes]) & (0xff << (8 - bits)));
+}
+
+static bool route_match(struct route_filter *f, struct rtmsg *rtm, struct rtattr *dst)
+{
+	unsigned char addr[16] = { 0 };
+
+	if (f->mode == PFX_NONE)
+		return true;
+	if (rtm->rtm_family != f->pfx.family)
+		return false;
+
+	if (dst)
+		memcpy(addr, RTA_DATA(dst), RTA_PAYLOAD(dst) > 16 ? 16 : RTA_PAYLOAD(dst));
+
+	switch (f->mode) {
+	case PFX_EXACT:
+		return rtm->rtm_dst_len == f->pfx.len && bits_match(addr, f->pfx.addr, f->pfx.len);
+	case PFX_ROOT:
+		return rtm->rtm_dst_len >= f->pfx.len && bits_match(addr, f->pfx.addr, f->pfx.len);
+	case PFX_MATCH:
+		return rtm->rtm_dst_len <= f->pfx.len && bits_match(addr, f->pfx.addr, rtm->rtm_dst_len);
+	}
+
+	return false;
+}
+
+static const char *route_addr(struct route_filter *f, struct rtattr *rta, struct filter_val *val)
+{
+	if (!rta || !inet_ntop(f->rtm->rtm_family, RTA_DATA(rta), val->buf, sizeof(val->buf)))
+		return "";
+
+	return val->buf;
+}
+
+static void route_field(void *rec, int id, struct filter_val *val)
+{
+	struct route_filter *f = rec;
+	struct rtmsg *rtm = f->rtm;
+	struct rtattr **tb = f->tb;
+
+	switch (id) {
+	case RF_DST:
+		if (!tb[RTA_DST]) {
+			val->str = "default";
+			break;
+		}
+		val->str = route_addr(f, tb[RTA_DST], val);
+		if (*val->str) {
+			size_t len = strlen(val->buf);
+
+			snprintf(&val->buf[len], sizeof(val->buf) - len, "/%d", rtm->rtm_dst_len);
+		}
+		break;
+	case RF_DSTLEN:
+		val->num = rtm->rtm_dst_len;
+		break;
+	case RF_GATEWAY:
+		val->str = route_addr(f, tb[RTA_GATEWAY], val);
+		break;
+	case RF_DEV:
+		if (tb[RTA_OIF])
+			val->str = en_ifname(nl_attr_u32(tb[RTA_OIF]));
+		break;
+	case RF_TABLE:
+		val->str = id2name(tables, NELEMS(tables), f->rt_table, val->buf);
+		break;
+	case RF_PROTO:
+		val->str = id2name(protos, NELEMS(protos), rtm->rtm_protocol, val->buf);
+		break;
+	case RF_SCOPE:
+		val->str = id2name(scopes, NELEMS(scopes), rtm->rtm_scope, val->buf);
+		break;
+	case RF_TYPE:
+		val->str = id2name(types, NELEMS(types), rtm->rtm_type, val->buf);
+		break;
+	case RF_PREFSRC:
+		val->str = route_addr(f, tb[RTA_PREFSRC], val);
+		break;
+	case RF_METRIC:
+		if (tb[RTA_PRIORITY])
+			val->num = nl_attr_u32(tb[RTA_PRIORITY]);
+		break;
+	}
+}
+
+static void route_nexthops_text(int family, struct rtattr *mp)
+{
+	struct rtnexthop *nh = RTA_DATA(mp);
+	int len = RTA_PAYLOAD(mp);
+
+	for (; RTNH_OK(nh, len); len -= NLMSG_ALIGN(nh->rtnh_len), nh = RTNH_NEXT(nh)) {
+		struct rtattr *tb[RTA_MAX + 1];
+
+		nl_attr_parse(tb, RTA_MAX, RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh));
+		out_str("\n\tnexthop");
+		if (tb[RTA_GATEWAY]) {
+			out_str(" via ");
+			out_addr(family, RTA_DATA(tb[RTA_GATEWAY]));
+		}
+		out_str(" dev ");
+		out_str(en_ifname(nh->rtnh_ifindex));
+		out_str(" weight ");
+		out_u64(nh->rtnh_hops + 1);
+	}
+}
+
+static void route_nexthops_json(int family, struct rtattr *mp)
+{
+	struct rtnexthop *nh = RTA_DATA(mp);
+	int len = RTA_PAYLOAD(mp);
+
+	json_begin_array("nexthops");
+	for (; RTNH_OK(nh, len); len -= NLMSG_ALIGN(nh->rtnh_len), nh = RTNH_NEXT(nh)) {
+		struct rtattr *tb[RTA_MAX + 1];
+
+		nl_attr_parse(tb, RTA_MAX, RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh));
+		json_begin_object(NULL);
+		if (tb[RTA_GATEWAY])
+			json_addr("gateway", family, RTA_DATA(tb[RTA_GATEWAY]));
+		json_string("dev", en_ifname(nh->rtnh_ifindex));
+		json_uint("weight", nh->rtnh_hops + 1);
+		json_end_object();
+	}
+	json_end_array();
+}
+
+static void route_show_json(struct rtmsg *rtm, uint32_t table, struct rtattr *tb[])
+{
+	char buf[12];
+
+	json_begin_object(NULL);
+	if (rtm->rtm_type != RTN_UNICAST)
+		json_string("type", id2name(types, NELEMS(types), rtm->rtm_type, buf));
+
+	if (tb[RTA_DST]) {
+		json_addr("dst", rtm->rtm_family, RTA_DATA(tb[RTA_DST]));
+		json_uint("dstlen", rtm->rtm_dst_len);
+	} else
+		json_string("dst", "default");
+
+	if (tb[RTA_GATEWAY])
+		json_addr("gateway", rtm->rtm_family, RTA_DATA(tb[RTA_GATEWAY]));
+	if (tb[RTA_OIF])
+		json_string("dev", en_ifname(nl_attr_u32(tb[RTA_OIF])));
+	json_string("table",    id2name(tables, NELEMS(tables), table, buf));
+	json_string("protocol", id2name(protos, NELEMS(protos), rtm->rtm_protocol, buf));
+	json_string("scope",    id2name(scopes, NELEMS(scopes), rtm->rtm_scope, buf));
+	if (tb[RTA_PREFSRC])
+		json_addr("prefsrc", rtm->rtm_family, RTA_DATA(tb[RTA_PREFSRC]));
+	if (tb[RTA_PRIORITY])
+		json_uint("metric", nl_attr_u32(tb[RTA_PRIORITY]));
+	if (tb[RTA_MULTIPATH])
+		route_nexthops_json(rtm->rtm_family, tb[RTA_MULTIPATH]);
+	json_end_object();
+}
+
+static void route_show_text(struct rtmsg *rtm, uint32_t table, struct rtattr *tb[])
+{
+	char buf[12];
+
+	if (rtm->rtm_type != RTN_UNICAST) {
+		out_str(id2name(types, NELEMS(types), rtm->rtm_type, buf));
+		out_char(' ');
+	}
+
+	if (tb[RTA_DST]) {
+		out_addr(rtm->rtm_family, RTA_DATA(tb[RTA_DST]));
+		if (rtm->rtm_dst_len != (rtm->rtm_family == AF_INET6 ? 128 : 32)) {
+			out_char('/');
+			out_u64(rtm->rtm_dst_len);
+		}
+	} else
+		out_str("default");
+
+	if (tb[RTA_GATEWAY]) {
+		out_str(" via ");
+		out_addr(rtm->rtm_family, RTA_DATA(tb[RTA_GATEWAY]));
+	}
+	if (tb[RTA_OIF]) {
+		out_str(" dev ");
+		out_str(en_ifname(nl_attr_u32(tb[RTA_OIF])));
+	}
+	if (table != RT_TABLE_MAIN) {
+		out_str(" table ");
+		out_str(id2name(tables, NELEMS(tables), table, buf));
+	}
+	if (rtm->rtm_protocol != RTPROT_BOOT) {
+		out_str(" proto ");
+		out_str(id2name(protos, NELEMS(protos), rtm->rtm_protocol, buf));
+	}
+	if (rtm->rtm_scope != RT_SCOPE_UNIVERSE) {
+		out_str(" scope ");
+		out_str(id2name(scopes, NELEMS(scopes), rtm->rtm_scope, buf));
+	}
+	if (tb[RTA_PREFSRC]) {
+		out_str(" src ");
+		out_addr(rtm->rtm_family, RTA_DATA(tb[RTA_PREFSRC]));
+	}
+	if (tb[RTA_PRIORITY]) {
+		out_str(" metric ");
+		out_u64(nl_attr_u32(tb[RTA_PRIORITY]));
+	}
+	if (tb[RTA_MULTIPATH])
+		route_nexthops_text(rtm->rtm_family, tb[RTA_MULTIPATH]);
+	out_char('\n');
+}
+
+static int route_show_one(struct nlmsghdr *nlh, void *arg)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct route_filter *f = arg;
+	struct rtattr *tb[RTA_MAX + 1];
+	uint32_t table;
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE)
+		return 0;
+	if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)
+		return 0;
+	if (rtm->rtm_flags & RTM_F_CLONED)
+		return 0;
+
+	nl_attr_parse(tb, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+
+	/* The kernel filters too, unless it predates strict checking */
+	table = tb[RTA_TABLE] ? nl_attr_u32(tb[RTA_TABLE]) : rtm->rtm_table;
+	if (f->table && table != f->table)
+		return 0;
+	if (f->proto >= 0 && rtm->rtm_protocol != f->proto)
+		return 0;
+	if (!route_match(f, rtm, tb[RTA_DST]))
+		return 0;
+
+	f->rtm = rtm;
+	f->rt_table = table;
+	f->tb = tb;
+	if (!filter_match(f->flt, route_field, f))
+		return 0;
+
+	if (f->json)
+		route_show_json(rtm, table, tb);
+	else
+		route_show_text(rtm, table, tb);
+
+	return 0;
+}
+
+static void route_show(ArgParser *ap)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg    rtm;
+		char            attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg)),
+		.nh.nlmsg_type  = RTM_GETROUTE,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.rtm.rtm_family = AF_UNSPEC,
+	};
+	struct route_filter f = {
+		.json  = en_json(),
+		.table = RT_TABLE_MAIN,
+		.proto = -1,
+		.flt   = en_filter(route_fields, NELEMS(route_fields)),
+	};
+	int i, argc = ap_len_args(ap);
+
+	for (i = 0; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+
+		if (!strcmp(arg, "table") || !strcmp(arg, "proto") ||
+		    !strcmp(arg, "root") || !strcmp(arg, "match")) {
+			if (++i >= argc)
+				en_errx(1, "missing argument to '%s'", arg);
+		}
+
+		if (!strcmp(arg, "table"))
+			f.table = name2id(tables, NELEMS(tables), ap_get_arg(ap, i), "table");
+		else if (!strcmp(arg, "proto"))
+			f.proto = name2id(protos, NELEMS(protos), ap_get_arg(ap, i), "protocol");
+		else if (!strcmp(arg, "root")) {
+			f.mode = PFX_ROOT;
+			en_parse_prefix(ap_get_arg(ap, i), &f.pfx);
+		} else if (!strcmp(arg, "match")) {
+			f.mode = PFX_MATCH;
+			en_parse_prefix(ap_get_arg(ap, i), &f.pfx);
+		} else {
+			f.mode = PFX_EXACT;
+			en_parse_prefix(arg, &f.pfx);
+		}
+	}
+
+	if (f.mode != PFX_NONE)
+		req.rtm.rtm_family = f.pfx.family;
+	if (f.table) {
+		req.rtm.rtm_table = f.table < 256 ? f.table : RT_TABLE_UNSPEC;
+		nl_attr_put_u32(&req.nh, sizeof(req), RTA_TABLE, f.table);
+	}
+	if (f.proto >= 0)
+		req.rtm.rtm_protocol = f.proto;
+
+	if (f.json)
+		json_begin_array(NULL);
+	if (nl_query(en_rtnl(), &req.nh, route_show_one, &f) && errno != ENOENT)
+		en_err(1, "Failed reading routes");
+	if (f.json)
+		json_end_array();
+}
+
+/*
+ * Changes are queued on the write pipeline, many of them go to the kernel
+ * in a single sendmsg() and errors are reported when the ACKs come back.
+ */
+static void route_modify(ArgParser *ap, int cmd, int flags)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg    rtm;
+		char            attr[128];
+	} req = {
+		.nh.nlmsg_len      = NLMSG_LENGTH(sizeof(struct rtmsg)),
+		.nh.nlmsg_type     = cmd,
+		.nh.nlmsg_flags    = flags,
+		.rtm.rtm_table     = RT_TABLE_MAIN,
+	};
+	int i, argc = ap_len_args(ap);
+	struct prefix dst, gw;
+	uint32_t table = RT_TABLE_MAIN;
+	bool have_dst = false, have_gw = false;
+
+	for (i = 0; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+		char *val, *end;
+
+		if (strcmp(arg, "via") && strcmp(arg, "dev") && strcmp(arg, "table") &&
+		    strcmp(arg, "proto") && strcmp(arg, "metric")) {
+			if (have_dst)
+				en_errx(1, "unknown argument '%s'", arg);
+			en_parse_prefix(arg, &dst);
+			have_dst = true;
+			continue;
+		}
+
+		if (++i >= argc)
+			en_errx(1, "missing argument to '%s'", arg);
+		val = ap_get_arg(ap, i);
+
+		if (!strcmp(arg, "via")) {
+			if (!strcmp(val, "default") || strchr(val, '/'))
+				en_errx(1, "invalid gateway '%s'", val);
+			en_parse_prefix(val, &gw);
+			have_gw = true;
+		} else if (!strcmp(arg, "dev"))
+			nl_attr_put_u32(&req.nh, sizeof(req), RTA_OIF, en_ifindex(val));
+		else if (!strcmp(arg, "table"))
+			table = name2id(tables, NELEMS(tables), val, "table");
+		else if (!strcmp(arg, "proto"))
+			req.rtm.rtm_protocol = name2id(protos, NELEMS(protos), val, "protocol");
+		else {
+			unsigned long metric = strtoul(val, &end, 0);
+
+			if (*val == 0 || *end != 0 || metric > UINT32_MAX)
+				en_errx(1, "invalid metric '%s'", val);
+			nl_attr_put_u32(&req.nh, sizeof(req), RTA_PRIORITY, metric);
+		}
+	}
+
+	if (!have_dst)
+		en_errx(1, "missing destination prefix");
+	if (have_gw && gw.family != dst.family)
+		en_errx(1, "gateway and destination address family mismatch");
+
+	req.rtm.rtm_family = dst.family;
+	req.rtm.rtm_dst_len = dst.len;
+	if (dst.len)
+		nl_attr_put(&req.nh, sizeof(req), RTA_DST, dst.addr, dst.family == AF_INET6 ? 16 : 4);
+	if (have_gw)
+		nl_attr_put(&req.nh, sizeof(req), RTA_GATEWAY, gw.addr, gw.family == AF_INET6 ? 16 : 4);
+
+	/*
+	 * A delete matches on any non-zero protocol and type, leave them out
+	 * unless given so it finds kernel, static and dhcp routes alike.
+	 */
+	if (cmd == RTM_NEWROUTE) {
+		if (!req.rtm.rtm_protocol)
+			req.rtm.rtm_protocol = RTPROT_BOOT;
+		req.rtm.rtm_type = RTN_UNICAST;
+		req.rtm.rtm_scope = have_gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+	} else
+		req.rtm.rtm_scope = RT_SCOPE_NOWHERE;
+
+	req.rtm.rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+	if (table >= 256)
+		nl_attr_put_u32(&req.nh, sizeof(req), RTA_TABLE, table);
+
+	en_tx(&req.nh);
+}
+
+static void route_add(ArgParser *ap)
+{
+	route_modify(ap, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL);
+}
+
+static void route_replace(ArgParser *ap)
+{
+	route_modify(ap, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE);
+}
+
+static void route_del(ArgParser *ap)
+{
+	route_modify(ap, RTM_DELROUTE, 0);
+}
+
+static void route_cmds(ArgParser *route)
+{
+	filter_cmd(ap_add_cmd(route, "show list", "Show routes: [table T] [proto P] [[root|match] PREFIX]", route_show));
+	ap_add_cmd(route, "add", "Add route: PREFIX [via GW] [dev IFNAME] [table T] [proto P] [metric N]", route_add);
+	ap_add_cmd(route, "replace", "Add or replace route: PREFIX [via GW] [dev IFNAME] [table T] [proto P] [metric N]", route_replace);
+	ap_add_cmd(route, "del delete", "Delete route: PREFIX [via GW] [dev IFNAME] [table T] [proto P] [metric N]", route_del);
+}
+
+int route_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "route", "Routing table management", route_cmds, NULL);
+
+	return 0;
+}
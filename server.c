@@ -0,0 +1,349 @@
+#define _GNU_SOURCE		/* accept4(), O_PATH, struct ucred, secure_getenv() */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "en.h"
+#include "out.h"
+
+#define SRV_MSGSZ	65536		/* Max size of a forwarded command line */
+#define SRV_NFDS	4		/* stdin, stdout, stderr and cwd */
+#define SRV_TIMEOUT	5		/* Seconds to wait for a client's command */
+
+static bool        active;
+static struct stat netns;		/* The server's own network namespace */
+static char        sock_name[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+bool server_active(void)
+{
+	return active;
+}
+
+static const char *sock_path(void)
+{
+	const char *path = secure_getenv("EN_SOCKET");
+
+	return path ? path : EN_SOCKET;
+}
+
+static int sock_addr(struct sockaddr_un *sun, const char *path)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (!*path || strlen(path) >= sizeof(sun->sun_path))
+		return -1;
+	strcpy(sun->sun_path, path);
+
+	return 0;
+}
+
+/*
+ * Forward the command line to a running server.  The server gets our
+ * stdio and working directory as file descriptors and writes straight
+ * to them, only the exit status comes back over the socket.  Returns -1
+ * if there is no server, or it asks us to run the command ourselves.
+ */
+int client(int argc, char *argv[])
+{
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(SRV_NFDS * sizeof(int))];
+	} ctrl;
+	struct msghdr msg = {
+		.msg_control    = &ctrl,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+	int i, sd, status, fds[SRV_NFDS] = { 0, 1, 2, -1 };
+	struct sockaddr_un sun;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char *buf;
+	size_t len = 0;
+	ssize_t n;
+
+	/* argv[0] is always sent, so an empty argument is never lost */
+	len = sizeof("en");
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--server"))
+			return -1;
+		len += strlen(argv[i]) + 1;
+	}
+	if (len > SRV_MSGSZ || sock_addr(&sun, sock_path()))
+		return -1;
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun))) {
+		close(sd);
+		return -1;
+	}
+
+	buf = malloc(len + 1);
+	fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (!buf || fds[3] < 0) {
+		status = -1;
+		goto done;
+	}
+
+	strcpy(buf, "en");
+	for (len = sizeof("en"), i = 1; i < argc; i++) {
+		strcpy(&buf[len], argv[i]);
+		len += strlen(argv[i]) + 1;
+	}
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	status = -1;
+	if (sendmsg(sd, &msg, MSG_NOSIGNAL) < 0)
+		goto done;
+
+	do
+		n = recv(sd, &status, sizeof(status), 0);
+	while (n < 0 && errno == EINTR);
+	if (n != sizeof(status)) {
+		warnx("server went away");
+		status = 1;
+	} else if (status == EN_LOCAL)
+		status = -1;
+done:
+	if (fds[3] >= 0)
+		close(fds[3]);
+	free(buf);
+	close(sd);
+
+	return status;
+}
+
+static int recv_cmd(int sd, char *buf, int fds[])
+{
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(SRV_NFDS * sizeof(int))];
+	} ctrl;
+	struct iovec iov = { buf, SRV_MSGSZ };
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = &ctrl,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	len = recvmsg(sd, &msg, MSG_CMSG_CLOEXEC);
+	if (len <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	if (cmsg->cmsg_len != CMSG_LEN(SRV_NFDS * sizeof(int))) {
+		int i, num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+		for (i = 0; i < num; i++)
+			close(((int *)CMSG_DATA(cmsg))[i]);
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), SRV_NFDS * sizeof(int));
+
+	return len;
+}
+
+/* Is the client in the same network namespace as we are? */
+static bool same_netns(pid_t pid)
+{
+	char path[64];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "/proc/%d/ns/net", (int)pid);
+	if (stat(path, &st))
+		return false;
+
+	return st.st_dev == netns.st_dev && st.st_ino == netns.st_ino;
+}
+
+/*
+ * Run one forwarded command with the client's stdio and working directory
+ * in place of our own, in a child of its own.  A client in another network
+ * namespace, or one we failed to fork for with @local, is told to run the
+ * command itself, the server can only see and change its own namespace.
+ */
+static void serve(ArgParser *ap, int sd, bool local)
+{
+	static char buf[SRV_MSGSZ + 1];
+	static char *argv[SRV_MSGSZ + 1];
+	int i, len, argc = 0, status, fds[SRV_NFDS];
+	struct ucred cred;
+	socklen_t optlen = sizeof(cred);
+
+	if (getsockopt(sd, SOL_SOCKET, SO_PEERCRED, &cred, &optlen) ||
+	    (cred.uid != 0 && cred.uid != geteuid()))
+		return;
+
+	len = recv_cmd(sd, buf, fds);
+	if (len < 0)
+		return;
+
+	/* NUL terminated strings, argv[0] first */
+	status = buf[len - 1] ? -1 : !local && same_netns(cred.pid) ? 0 : EN_LOCAL;
+	if (status) {
+		for (i = 0; i < SRV_NFDS; i++)
+			close(fds[i]);
+		if (status == EN_LOCAL)
+			send(sd, &status, sizeof(status), MSG_NOSIGNAL);
+		return;
+	}
+	for (i = 0; i < len; i += strlen(&buf[i]) + 1)
+		argv[argc++] = &buf[i];
+	argv[argc] = NULL;
+
+	for (i = 0; i < 3; i++)
+		dup2(fds[i], i);
+	if (fchdir(fds[3]))
+		warn("client working directory");
+	for (i = 0; i < SRV_NFDS; i++)
+		close(fds[i]);
+
+	status = en_run(ap, argc, argv);
+	if (en_tx_flush())
+		status = 1;
+
+	out_flush();
+	fflush(stderr);
+
+	send(sd, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+/* Remove the socket on the way out, then die of the signal as usual */
+static void server_stop(int sig)
+{
+	unlink(sock_name);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/*
+ * Each client gets a child, so a slow command, e.g. with --all-netns,
+ * does not hold up the others.  The child inherits the parser tree and
+ * the interface cache, synced just before, but opens netlink sockets of
+ * its own.  Termination signals are blocked around fork() so a child
+ * never runs server_stop().
+ */
+static void spawn(ArgParser *ap, int sd, int cd)
+{
+	sigset_t set, old;
+	pid_t pid;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	sigprocmask(SIG_BLOCK, &set, &old);
+
+	iface_sync();
+	pid = fork();
+	if (!pid) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		sigprocmask(SIG_SETMASK, &old, NULL);
+
+		close(sd);
+		iface_detach();
+		en_nl_close();
+		serve(ap, cd, false);
+		_exit(0);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	if (pid < 0) {
+		warn("fork");
+		serve(ap, cd, true);
+	}
+}
+
+/*
+ * Resident server, keeps the parser tree and interface memo for all
+ * clients.  Listens on EN_SOCKET, or $EN_SOCKET, until it is killed.
+ */
+int server(ArgParser *ap)
+{
+	const char *path = sock_path();
+	struct sockaddr_un sun;
+	int sd;
+
+	if (active)
+		en_errx(1, "server already running");
+	if (batch_active())
+		en_errx(1, "server cannot run in batch mode");
+	if (sock_addr(&sun, path))
+		en_errx(1, "invalid socket path '%s'", path);
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		en_err(1, "socket");
+
+	/* Stale socket from a previous run, or is someone home? */
+	if (!connect(sd, (struct sockaddr *)&sun, sizeof(sun)))
+		en_errx(1, "%s: server already running", path);
+	unlink(path);
+
+	close(sd);
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		en_err(1, "socket");
+
+	if (stat("/proc/self/ns/net", &netns))
+		en_err(1, "/proc/self/ns/net");
+
+	umask(077);
+	if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)) || listen(sd, 128))
+		en_err(1, "%s", path);
+
+	strcpy(sock_name, sun.sun_path);
+	signal(SIGTERM, server_stop);
+	signal(SIGINT, server_stop);
+	signal(SIGHUP, server_stop);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);	/* Children are reaped for us */
+	iface_monitor();
+	active = true;
+
+	while (1) {
+		struct timeval tv = { .tv_sec = SRV_TIMEOUT };
+		int cd;
+
+		cd = accept4(sd, NULL, NULL, SOCK_CLOEXEC);
+		if (cd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			unlink(sock_name);
+			en_err(1, "accept");
+		}
+
+		/* A client that connects and never sends must not hang around */
+		setsockopt(cd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		spawn(ap, sd, cd);
+		close(cd);
+	}
+}
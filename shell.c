@@ -0,0 +1,466 @@
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "en.h"
+#include "out.h"
+
+#define SHELL_PROMPT	"en> "
+#define SHELL_HISTFILE	".en_history"
+#define SHELL_HISTMAX	1000
+#define SHELL_LINEMAX	4096
+
+struct history {
+	char  *lines[SHELL_HISTMAX];	/* Ring buffer, oldest first */
+	int    first;
+	int    len;
+	int    base;		/* Number of the oldest entry, for !N */
+	FILE  *fp;
+};
+
+static struct history hist;
+
+static const char *hist_get(int i)
+{
+	return hist.lines[(hist.first + i) % SHELL_HISTMAX];
+}
+
+static void hist_add(const char *line, bool save)
+{
+	char *copy;
+
+	if (hist.len && !strcmp(hist_get(hist.len - 1), line))
+		return;
+
+	copy = strdup(line);
+	if (!copy)
+		return;
+
+	if (hist.len == SHELL_HISTMAX) {
+		free(hist.lines[hist.first]);
+		hist.lines[hist.first] = copy;
+		hist.first = (hist.first + 1) % SHELL_HISTMAX;
+		hist.base++;
+	} else
+		hist.lines[(hist.first + hist.len++) % SHELL_HISTMAX] = copy;
+
+	if (save && hist.fp) {
+		fprintf(hist.fp, "%s\n", line);
+		fflush(hist.fp);
+	}
+}
+
+static void hist_open(void)
+{
+	const char *home = getenv("HOME");
+	char path[512], *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	FILE *fp;
+
+	if (!home)
+		return;
+	snprintf(path, sizeof(path), "%s/%s", home, SHELL_HISTFILE);
+
+	fp = fopen(path, "r");
+	if (fp) {
+		while ((n = getline(&line, &len, fp)) != -1) {
+			if (n > 0 && line[n - 1] == '\n')
+				line[--n] = 0;
+			if (n)
+				hist_add(line, false);
+		}
+		free(line);
+		fclose(fp);
+	}
+
+	hist.fp = fopen(path, "a");
+}
+
+static void hist_close(void)
+{
+	int i;
+
+	if (hist.fp)
+		fclose(hist.fp);
+	for (i = 0; i < hist.len; i++)
+		free(hist.lines[(hist.first + i) % SHELL_HISTMAX]);
+	memset(&hist, 0, sizeof(hist));
+}
+
+static void hist_show(void)
+{
+	int i;
+
+	for (i = 0; i < hist.len; i++)
+		out_printf("%5d  %s\n", hist.base + i + 1, hist_get(i));
+	out_flush();
+}
+
+/*
+ * Expand !! and !N, like the shell does.  Returns false, after telling
+ * the user, if there is no such history entry.
+ */
+static bool hist_expand(char *line, size_t size)
+{
+	const char *entry;
+	char *end;
+	long num;
+
+	if (line[0] != '!' || !line[1])
+		return true;
+
+	if (!strcmp(line, "!!"))
+		num = hist.base + hist.len;
+	else {
+		num = strtol(&line[1], &end, 10);
+		if (*end)
+			num = 0;
+		else if (num < 0)
+			num += hist.base + hist.len + 1;
+	}
+
+	if (num <= hist.base || num > hist.base + hist.len) {
+		warnx("%s: event not found", line);
+		return false;
+	}
+
+	entry = hist_get(num - hist.base - 1);
+	snprintf(line, size, "%s", entry);
+	printf("%s\n", line);
+
+	return true;
+}
+
+static void term_write(const char *str, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, str, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		str += n;
+		len -= n;
+	}
+}
+
+static void term_refresh(const char *buf, size_t len, size_t pos)
+{
+	char seq[32];
+
+	term_write("\r" SHELL_PROMPT, strlen(SHELL_PROMPT) + 1);
+	term_write(buf, len);
+	term_write("\x1b[K\r", 4);
+	snprintf(seq, sizeof(seq), "\x1b[%zuC", strlen(SHELL_PROMPT) + pos);
+	term_write(seq, strlen(seq));
+}
+
+enum {
+	KEY_UP = 0x100,
+	KEY_DOWN,
+	KEY_LEFT,
+	KEY_RIGHT,
+	KEY_HOME,
+	KEY_END,
+	KEY_DEL,
+};
+
+/* Read exactly @len bytes, a sequence may arrive in pieces */
+static int term_read(char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = read(STDIN_FILENO, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Read one key press, decoding the VT100 escape sequences we care about */
+static int term_key(void)
+{
+	char c, seq[3];
+
+	if (term_read(&c, 1))
+		return -1;
+
+	if (c != 0x1b)
+		return (unsigned char)c;
+
+	if (term_read(seq, 2) || seq[0] != '[')
+		return 0;
+
+	switch (seq[1]) {
+	case 'A': return KEY_UP;
+	case 'B': return KEY_DOWN;
+	case 'C': return KEY_RIGHT;
+	case 'D': return KEY_LEFT;
+	case 'H': return KEY_HOME;
+	case 'F': return KEY_END;
+	case '3':
+		if (!term_read(&seq[2], 1) && seq[2] == '~')
+			return KEY_DEL;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Minimal line editor: cursor movement, history recall with up/down and
+ * the usual emacs control keys.  Returns -1 on end of input.
+ */
+static int term_getline(char *buf, size_t size)
+{
+	struct termios orig, raw;
+	size_t len = 0, pos = 0;
+	int key, idx = hist.len, rc = -1;
+	char *saved = NULL;
+
+	if (tcgetattr(STDIN_FILENO, &orig))
+		return -1;
+
+	raw = orig;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &raw))
+		return -1;
+
+	buf[0] = 0;
+	term_refresh(buf, len, pos);
+
+	while ((key = term_key()) >= 0) {
+		switch (key) {
+		case '\r':
+		case '\n':
+			term_write("\r\n", 2);
+			rc = len;
+			goto done;
+
+		case CTRL('c'):
+			term_write("^C\r\n", 4);
+			buf[0] = 0;
+			len = pos = 0;
+			break;
+
+		case CTRL('d'):
+			if (!len) {
+				term_write("\r\n", 2);
+				goto done;
+			}
+			/* fallthrough */
+		case KEY_DEL:
+			if (pos == len)
+				continue;
+			memmove(&buf[pos], &buf[pos + 1], len - pos);
+			len--;
+			break;
+
+		case 0x7f:
+		case CTRL('h'):
+			if (!pos)
+				continue;
+			memmove(&buf[pos - 1], &buf[pos], len - pos + 1);
+			pos--;
+			len--;
+			break;
+
+		case CTRL('a'):
+		case KEY_HOME:
+			pos = 0;
+			break;
+
+		case CTRL('e'):
+		case KEY_END:
+			pos = len;
+			break;
+
+		case CTRL('b'):
+		case KEY_LEFT:
+			if (pos)
+				pos--;
+			break;
+
+		case CTRL('f'):
+		case KEY_RIGHT:
+			if (pos < len)
+				pos++;
+			break;
+
+		case CTRL('k'):
+			buf[len = pos] = 0;
+			break;
+
+		case CTRL('u'):
+			memmove(buf, &buf[pos], len - pos + 1);
+			len -= pos;
+			pos = 0;
+			break;
+
+		case CTRL('p'):
+		case KEY_UP:
+		case CTRL('n'):
+		case KEY_DOWN:
+			if (key == CTRL('p') || key == KEY_UP) {
+				if (idx == 0)
+					continue;
+			} else if (idx == hist.len)
+				continue;
+
+			/* Keep what was typed, it is the last "entry" */
+			if (idx == hist.len) {
+				free(saved);
+				saved = strdup(buf);
+			}
+			idx += key == CTRL('p') || key == KEY_UP ? -1 : 1;
+			snprintf(buf, size, "%s", idx < hist.len ? hist_get(idx) : saved ? saved : "");
+			len = pos = strlen(buf);
+			break;
+
+		default:
+			if (key < ' ' || key > 0xff || len + 1 >= size)
+				continue;
+			memmove(&buf[pos + 1], &buf[pos], len - pos + 1);
+			buf[pos++] = key;
+			len++;
+			break;
+		}
+
+		term_refresh(buf, len, pos);
+	}
+done:
+	tcsetattr(STDIN_FILENO, TCSANOW, &orig);
+	free(saved);
+
+	return rc;
+}
+
+static int shell_getline(char *buf, size_t size, bool tty)
+{
+	size_t len;
+
+	if (tty)
+		return term_getline(buf, size);
+
+	if (!fgets(buf, size, stdin))
+		return -1;
+
+	len = strlen(buf);
+	if (len && buf[len - 1] == '\n')
+		buf[--len] = 0;
+	else if (len == size - 1) {
+		int c = getchar();
+
+		/* Just fits, the last line without a newline */
+		if (c == EOF)
+			return len;
+
+		/* Skip the rest, running part of a command would be worse */
+		while (c != EOF && c != '\n')
+			c = getchar();
+		warnx("line too long, max %zu characters", size - 2);
+		buf[0] = 0;
+		return 0;
+	}
+
+	return len;
+}
+
+/*
+ * Interactive shell, keeps the parser tree, netlink socket and interface
+ * memo across commands.  Each line is dispatched through en_run(), same
+ * as batch mode, but changes are flushed after each command so errors
+ * show up right away.
+ */
+static void shell(ArgParser *cmd)
+{
+	ArgParser *ap = ap_get_parent(cmd);
+	int argc, max = 16, rc = 0;
+	bool tty = isatty(STDIN_FILENO);
+	char line[SHELL_LINEMAX];
+	static bool running;
+	char **argv;
+
+	if (running)
+		en_errx(1, "already in a shell");
+	if (server_active())
+		en_exit(EN_LOCAL);
+	if (netns_worker())
+		en_errx(1, "shell cannot run in several namespaces");
+	running = true;
+
+	argv = malloc(max * sizeof(char *));
+	if (!argv)
+		err(1, "Failed allocating arguments");
+
+	en_set_json(en_json());
+	iface_monitor();
+	if (tty)
+		hist_open();
+
+	while (shell_getline(line, sizeof(line), tty) >= 0) {
+		char copy[SHELL_LINEMAX];
+
+		if (!hist_expand(line, sizeof(line)))
+			continue;
+		snprintf(copy, sizeof(copy), "%s", line);
+
+		argc = ap_tokenize(line, &argv, &max);
+		if (argc < 0) {
+			warnx("unterminated quote");
+			continue;
+		}
+		if (argc < 2)
+			continue;
+		argv[0] = "en";
+		if (tty)
+			hist_add(copy, true);
+
+		if (!strcmp(argv[1], "exit") || !strcmp(argv[1], "quit"))
+			break;
+		if (!strcmp(argv[1], "history")) {
+			hist_show();
+			continue;
+		}
+
+		rc = en_run(ap, argc, argv);
+		if (en_tx_flush())
+			rc = 1;
+	}
+
+	hist_close();
+	free(argv);
+	running = false;
+
+	/*
+	 * The parser tree now holds the last command, nothing more for the
+	 * en_run() that called us to do.  Unwind to it with our status.
+	 */
+	en_exit(rc);
+}
+
+int shell_init(ArgParser *ap)
+{
+	if (!ap_add_cmd(ap, "shell", "Interactive shell, with history", shell))
+		return 1;
+
+	return 0;
+}
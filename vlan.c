@@ -0,0 +1,179 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/if_bridge.h>
+
+#include "en.h"
+#include "out.h"
+
+struct vlan_filter {
+	bool json;
+	int  ifindex;
+	int  master;
+};
+
+static void vlan_flags_text(uint16_t flags)
+{
+	if (flags & BRIDGE_VLAN_INFO_PVID)
+		out_str(" PVID");
+	if (flags & BRIDGE_VLAN_INFO_UNTAGGED)
+		out_str(" untagged");
+}
+
+static void vlan_flags_json(uint16_t flags)
+{
+	if (!(flags & (BRIDGE_VLAN_INFO_PVID | BRIDGE_VLAN_INFO_UNTAGGED)))
+		return;
+
+	json_begin_array("flags");
+	if (flags & BRIDGE_VLAN_INFO_PVID)
+		json_string(NULL, "PVID");
+	if (flags & BRIDGE_VLAN_INFO_UNTAGGED)
+		json_string(NULL, "untagged");
+	json_end_array();
+}
+
+/*
+ * With RTEXT_FILTER_BRVLAN_COMPRESSED the kernel sends a range as two
+ * entries, RANGE_BEGIN and RANGE_END, render them as they are without
+ * ever expanding the range into single VIDs.
+ */
+static void vlan_show_port(struct vlan_filter *f, const char *ifname, struct rtattr *spec)
+{
+	struct rtattr *rta = RTA_DATA(spec);
+	int len = RTA_PAYLOAD(spec);
+	uint16_t begin = 0;
+	bool first = true;
+
+	if (f->json) {
+		json_begin_object(NULL);
+		json_string("ifname", ifname);
+		json_begin_array("vlans");
+	} else {
+		int w = strlen(ifname);
+
+		out_str(ifname);
+		out_pad(w < 16 ? 16 - w : 1);
+	}
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		struct bridge_vlan_info *vi;
+
+		if (rta->rta_type != IFLA_BRIDGE_VLAN_INFO || RTA_PAYLOAD(rta) < sizeof(*vi))
+			continue;
+
+		vi = RTA_DATA(rta);
+		if (vi->flags & BRIDGE_VLAN_INFO_RANGE_BEGIN) {
+			begin = vi->vid;
+			continue;
+		}
+
+		if (f->json) {
+			json_begin_object(NULL);
+			if (vi->flags & BRIDGE_VLAN_INFO_RANGE_END) {
+				json_uint("vlan", begin);
+				json_uint("vlanEnd", vi->vid);
+			} else
+				json_uint("vlan", vi->vid);
+			vlan_flags_json(vi->flags);
+			json_end_object();
+			continue;
+		}
+
+		if (!first)
+			out_pad(16);
+		first = false;
+
+		if (vi->flags & BRIDGE_VLAN_INFO_RANGE_END) {
+			out_u64(begin);
+			out_char('-');
+		}
+		out_u64(vi->vid);
+		vlan_flags_text(vi->flags);
+		out_char('\n');
+	}
+
+	if (f->json) {
+		json_end_array();
+		json_end_object();
+	} else if (first)
+		out_str("none\n");
+}
+
+static int vlan_show_one(struct nlmsghdr *nlh, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct vlan_filter *f = arg;
+	struct rtattr *tb[IFLA_MAX + 1];
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return 0;
+	if (f->ifindex && ifi->ifi_index != f->ifindex)
+		return 0;
+
+	nl_attr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+	if (!tb[IFLA_IFNAME] || !tb[IFLA_AF_SPEC])
+		return 0;
+
+	if (f->master && ifi->ifi_index != f->master &&
+	    (!tb[IFLA_MASTER] || (int)nl_attr_u32(tb[IFLA_MASTER]) != f->master))
+		return 0;
+
+	vlan_show_port(f, nl_attr_str(tb[IFLA_IFNAME]), tb[IFLA_AF_SPEC]);
+
+	return 0;
+}
+
+static void vlan_show(ArgParser *ap)
+{
+	struct {
+		struct nlmsghdr  nh;
+		struct ifinfomsg ifi;
+		char             attr[64];
+	} req = {
+		.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.nh.nlmsg_type  = RTM_GETLINK,
+		.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.ifi.ifi_family = AF_BRIDGE,
+	};
+	struct vlan_filter f = {
+		.json = en_json(),
+	};
+	int i, argc = ap_len_args(ap);
+
+	for (i = 0; i < argc; i++) {
+		char *arg = ap_get_arg(ap, i);
+
+		if (++i >= argc)
+			en_errx(1, "missing argument to '%s'", arg);
+
+		if (!strcmp(arg, "dev") || !strcmp(arg, "port"))
+			f.ifindex = en_ifindex(ap_get_arg(ap, i));
+		else if (!strcmp(arg, "bridge") || !strcmp(arg, "br"))
+			f.master = en_ifindex(ap_get_arg(ap, i));
+		else
+			en_errx(1, "unknown argument '%s'", arg);
+	}
+
+	nl_attr_put_u32(&req.nh, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_BRVLAN_COMPRESSED);
+
+	if (f.json)
+		json_begin_array(NULL);
+	else
+		out_str("port            vlan-id\n");
+	if (nl_query(en_rtnl(), &req.nh, vlan_show_one, &f))
+		en_err(1, "Failed reading VLANs");
+	if (f.json)
+		json_end_array();
+}
+
+static void vlan_cmds(ArgParser *vlan)
+{
+	ap_add_cmd(vlan, "show list", "Show port VLANs: [bridge BR] [dev IFNAME]", vlan_show);
+}
+
+int vlan_init(ArgParser *ap)
+{
+	ap_add_cmd_lazy(ap, "vlan", "Bridge VLAN table management", vlan_cmds, NULL);
+
+	return 0;
+}